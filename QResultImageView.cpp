@@ -1,17 +1,41 @@
 #include "QResultImageView.h"
 #include <QPainter>
 #include <QMouseEvent>
+#include <QElapsedTimer>
+#include <QFontMetricsF>
+#include <QFutureWatcher>
+#include <QImageReader>
+#include <QDataStream>
+#include <QFile>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QScreen>
+#include <QWindow>
 #include <qtimer.h>
+#include <algorithm>
+#include <numeric>
+#include <tuple>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define QRESULTIMAGEVIEW_SSE2
+#endif
 
 QResultImageView::QResultImageView(QWidget *parent)
     : QWidget(parent)
 {
     setMouseTracking(true);
+
+    progressiveResultRenderingTimer.setSingleShot(true);
+    progressiveResultRenderingTimer.setInterval(0);
+    connect(&progressiveResultRenderingTimer, SIGNAL(timeout()), this, SLOT(continueProgressiveResultRendering()));
 }
 
 void QResultImageView::setImage(const QImage& image)
 {
+    cancelImageFileLoading();
+
     sourceImage = image;
+    sourceSize = sourceImage.size();
     sourcePixmap = QPixmap();
     updateSourcePyramid();
 
@@ -19,67 +43,475 @@ void QResultImageView::setImage(const QImage& image)
 }
 
 void QResultImageView::setImagePyramid(const std::vector<QImage>& imagePyramid)
+{
+    // Copying the vector only copies the references to the image data
+    setImagePyramid(std::vector<QImage>(imagePyramid));
+}
+
+void QResultImageView::setImagePyramid(std::vector<QImage>&& imagePyramid)
+{
+    cancelImageFileLoading();
+
+    setSourceImagePyramid(std::move(imagePyramid));
+
+    redrawEverything(getEventualTransformationMode());
+}
+
+void QResultImageView::setResults(Results results)
+{
+    setSharedResults(std::make_shared<const Results>(std::move(results)));
+}
+
+void QResultImageView::setSharedResults(std::shared_ptr<const Results> results)
+{
+    resetMouseOnResult();
+
+    setResultData(std::move(results));
+
+    drawResultsToViewport();
+    update(destinationRect);
+}
+
+void QResultImageView::setImageAndResults(const QImage& image, Results results)
+{
+    setImageAndSharedResults(image, std::make_shared<const Results>(std::move(results)));
+}
+
+void QResultImageView::setImageAndSharedResults(const QImage& image, std::shared_ptr<const Results> results)
+{
+    cancelImageFileLoading();
+    beginNewFrame();
+
+    sourceImage = image;
+    sourceSize = sourceImage.size();
+    sourcePixmap = QPixmap();
+    updateSourcePyramid();
+
+    resetMouseOnResult();
+    setResultData(std::move(results));
+
+    limitFrameHistory();
+
+    redrawEverything(getEventualTransformationMode());
+}
+
+void QResultImageView::setImagePyramidAndResults(std::vector<QImage> imagePyramid, Results results)
+{
+    setImagePyramidAndSharedResults(std::move(imagePyramid), std::make_shared<const Results>(std::move(results)));
+}
+
+void QResultImageView::setImagePyramidAndSharedResults(std::vector<QImage> imagePyramid, std::shared_ptr<const Results> results)
+{
+    cancelImageFileLoading();
+    beginNewFrame();
+
+    setSourceImagePyramid(std::move(imagePyramid));
+
+    resetMouseOnResult();
+    setResultData(std::move(results));
+
+    limitFrameHistory();
+
+    redrawEverything(getEventualTransformationMode());
+}
+
+void QResultImageView::setSourceImagePyramid(std::vector<QImage>&& imagePyramid)
 {
     if (!imagePyramid.empty()) {
-        sourceImage = imagePyramid[0];
+        sourceImage = std::move(imagePyramid[0]);
     }
     else {
         sourceImage = QImage();
     }
+    sourceSize = sourceImage.size();
     sourcePixmap = QPixmap();
 
     sourceImagePyramid.clear();
     sourcePixmapPyramid.clear();
 
     for (size_t i = 1, end = imagePyramid.size(); i < end; ++i) {
-        const double scaleFactor = std::sqrt(imagePyramid[i].width() * imagePyramid[i].height() / static_cast<double>(sourceImage.width() * sourceImage.height()));
-        sourceImagePyramid[scaleFactor] = imagePyramid[i];
+        const double scaleFactor = std::sqrt(imagePyramid[i].width() * imagePyramid[i].height() / static_cast<double>(sourceSize.width() * sourceSize.height()));
+        sourceImagePyramid[scaleFactor] = std::move(imagePyramid[i]);
     }
+}
 
-    redrawEverything(getEventualTransformationMode());
+void QResultImageView::setResultData(std::shared_ptr<const Results> newResults)
+{
+    results = newResults ? std::move(newResults) : std::make_shared<const Results>();
+    setResultGeometry();
 }
 
-void QResultImageView::setResults(const std::vector<Result>& results)
+void QResultImageView::setFrameHistoryLimits(size_t maxFrameCount, size_t maxByteCount)
 {
-    this->results = results;
-    setResultPolygons();
+    maxFrameHistoryCount = maxFrameCount;
+    maxFrameHistoryBytes = maxByteCount;
 
-    drawResultsToViewport();
-    update();
+    if (maxFrameHistoryCount == 0) {
+        // the displayed frame stays, of course
+        frameHistory.clear();
+        frameHistoryIndex = 0;
+    }
+    else {
+        limitFrameHistory();
+    }
 }
 
-void QResultImageView::setImageAndResults(const QImage& image, const Results& results)
+size_t QResultImageView::getFrameHistorySize() const
 {
-    sourceImage = image;
+    return frameHistory.size();
+}
+
+size_t QResultImageView::getFrameHistoryPosition() const
+{
+    return frameHistory.empty() ? 0 : frameHistory.size() - 1 - frameHistoryIndex;
+}
+
+bool QResultImageView::seekFrameHistory(size_t framesBack)
+{
+    if (framesBack >= frameHistory.size()) {
+        return false;
+    }
+
+    const size_t index = frameHistory.size() - 1 - framesBack;
+
+    if (index != frameHistoryIndex) {
+        // A file still loading would otherwise end up replacing the image of a different frame
+        cancelImageFileLoading();
+
+        // The index would refer to a result of the other frame
+        resetMouseOnResult();
+
+        storeCurrentFrame();
+        restoreFrame(index);
+
+        redrawEverything(getEventualTransformationMode());
+    }
+
+    return true;
+}
+
+bool QResultImageView::stepFrameHistory(int steps)
+{
+    const long long framesBack = static_cast<long long>(getFrameHistoryPosition()) - steps;
+
+    if (framesBack < 0 || framesBack >= static_cast<long long>(frameHistory.size())) {
+        return false;
+    }
+
+    return seekFrameHistory(static_cast<size_t>(framesBack));
+}
+
+void QResultImageView::beginNewFrame()
+{
+    if (maxFrameHistoryCount == 0) {
+        return;
+    }
+
+    if (!frameHistory.empty()) {
+        storeCurrentFrame();
+    }
+
+    // The slot of the displayed frame stays empty until another frame is displayed
+    frameHistory.emplace_back();
+    frameHistoryIndex = frameHistory.size() - 1;
+}
+
+void QResultImageView::storeCurrentFrame()
+{
+    Q_ASSERT(frameHistoryIndex < frameHistory.size());
+
+    // Everything is moved, not copied, so switching frames is cheap
+    Frame& frame = frameHistory[frameHistoryIndex];
+    frame.byteCount = getCurrentFrameByteCount();
+    frame.sourceImage = std::move(sourceImage);
+    frame.sourceSize = sourceSize;
+    frame.sourcePixmap = std::move(sourcePixmap);
+    frame.sourceImagePyramid = std::move(sourceImagePyramid);
+    frame.sourcePixmapPyramid = std::move(sourcePixmapPyramid);
+    frame.results = std::move(results);
+    frame.resultBoundingRects = std::move(resultBoundingRects);
+    frame.resultDrawOrder = std::move(resultDrawOrder);
+    frame.resultLabelTexts = std::move(resultLabelTexts);
+    frame.resultPens = std::move(resultPens);
+    frame.resultPenIndices = std::move(resultPenIndices);
+    frame.resultVisibility = std::move(resultVisibility);
+    frame.scaledResultCacheScaleFactor = scaledResultCacheScaleFactor;
+    frame.scaledResultPolygons = std::move(scaledResultPolygons);
+    frame.scaledResultPaths = std::move(scaledResultPaths);
+
+    sourceImage = QImage();
+    sourceSize = QSize();
     sourcePixmap = QPixmap();
-    updateSourcePyramid();
+    sourceImagePyramid.clear();
+    sourcePixmapPyramid.clear();
+    results = std::make_shared<const Results>();
+    resultBoundingRects.clear();
+    resultDrawOrder.clear();
+    resultLabelTexts.clear();
+    resultVisibility.clear();
+    resultPens.clear();
+    resultPenIndices.clear();
+    scaledResultPolygons.clear();
+    scaledResultPaths.clear();
+}
 
-    this->results = results;
-    setResultPolygons();
+void QResultImageView::restoreFrame(size_t index)
+{
+    Q_ASSERT(index < frameHistory.size());
+
+    Frame& frame = frameHistory[index];
+    sourceImage = std::move(frame.sourceImage);
+    sourceSize = frame.sourceSize;
+    sourcePixmap = std::move(frame.sourcePixmap);
+    sourceImagePyramid = std::move(frame.sourceImagePyramid);
+    sourcePixmapPyramid = std::move(frame.sourcePixmapPyramid);
+    results = std::move(frame.results);
+    resultBoundingRects = std::move(frame.resultBoundingRects);
+    resultDrawOrder = std::move(frame.resultDrawOrder);
+    resultLabelTexts = std::move(frame.resultLabelTexts);
+    resultPens = std::move(frame.resultPens);
+    resultPenIndices = std::move(frame.resultPenIndices);
+    resultVisibility = std::move(frame.resultVisibility);
+    scaledResultCacheScaleFactor = frame.scaledResultCacheScaleFactor;
+    scaledResultPolygons = std::move(frame.scaledResultPolygons);
+    scaledResultPaths = std::move(frame.scaledResultPaths);
+
+    // the filter may have changed since; the paths are rebuilt only if that changes anything for this frame
+    updateResultVisibility();
+
+    frame = Frame();
+    frameHistoryIndex = index;
+}
 
-    redrawEverything(getEventualTransformationMode());
+void QResultImageView::limitFrameHistory()
+{
+    const auto getTotalByteCount = [this]() {
+        size_t byteCount = getCurrentFrameByteCount();
+        for (size_t i = 0, end = frameHistory.size(); i < end; ++i) {
+            if (i != frameHistoryIndex) {
+                byteCount += frameHistory[i].byteCount;
+            }
+        }
+        return byteCount;
+    };
+
+    // The oldest frames are evicted first; the displayed frame always stays. If the displayed frame is
+    // the oldest one (the user has gone all the way back), the newest frames are evicted instead.
+    while (frameHistory.size() > 1 && (frameHistory.size() > maxFrameHistoryCount || getTotalByteCount() > maxFrameHistoryBytes)) {
+        if (frameHistoryIndex > 0) {
+            frameHistory.pop_front();
+            --frameHistoryIndex;
+        }
+        else {
+            frameHistory.pop_back();
+        }
+    }
 }
 
-void QResultImageView::setImagePyramidAndResults(const std::vector<QImage>& imagePyramid, const Results& results)
+size_t QResultImageView::getCurrentFrameByteCount() const
 {
-    if (!imagePyramid.empty()) {
-        sourceImage = imagePyramid[0];
+    const auto getPixmapByteCount = [](const QPixmap& pixmap) {
+        return static_cast<size_t>(pixmap.width()) * pixmap.height() * pixmap.depth() / 8;
+    };
+
+    size_t byteCount = sourceImage.sizeInBytes() + getPixmapByteCount(sourcePixmap);
+
+    for (const auto& level : sourceImagePyramid) {
+        byteCount += level.second.sizeInBytes();
+    }
+    for (const auto& level : sourcePixmapPyramid) {
+        byteCount += getPixmapByteCount(level.second);
+    }
+
+    for (const Result& result : *results) {
+        // counted even if the results are shared with the caller, or with other frames
+        byteCount += sizeof(Result) + result.contour.size() * sizeof(QPointF) + 2 * result.label.size();
+    }
+
+    return byteCount;
+}
+
+void QResultImageView::setImageFile(const QString& path)
+{
+    cancelImageFileLoading();
+
+    const unsigned int generation = *imageFileGeneration;
+    const std::shared_ptr<std::atomic<unsigned int>> currentGeneration = imageFileGeneration;
+    const auto isCancelled = [currentGeneration, generation]() {
+        return *currentGeneration != generation;
+    };
+
+    // A preview roughly the size of the widget is all that the default zoom level needs
+    const int maxPreviewDimension = std::max(256, std::max(width(), height()));
+
+    auto* previewWatcher = new QFutureWatcher<LoadedImageFile>(this);
+    connect(previewWatcher, &QFutureWatcherBase::finished, this, [this, previewWatcher, isCancelled, generation]() {
+        const LoadedImageFile preview = previewWatcher->result();
+        previewWatcher->deleteLater();
+
+        // The full-resolution image may have been faster
+        if (!isCancelled() && imageFileGenerationLoaded != generation && !preview.image.isNull()) {
+            showImageFilePreview(preview);
+        }
+    });
+    previewWatcher->setFuture(QtConcurrent::run([path, maxPreviewDimension, isCancelled]() {
+        return readImageFilePreview(path, maxPreviewDimension, isCancelled);
+    }));
+
+    const Qt::TransformationMode pyramidTransformationMode = getPyramidTransformationMode();
+
+    auto* watcher = new QFutureWatcher<LoadedImageFile>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher, isCancelled, generation, path]() {
+        LoadedImageFile loaded = watcher->result();
+        watcher->deleteLater();
+
+        if (isCancelled()) {
+            return;
+        }
+
+        imageFileGenerationLoaded = generation;
+
+        if (loaded.image.isNull()) {
+            emit imageFileLoadFailed(path, loaded.errorString);
+        }
+        else {
+            showLoadedImageFile(loaded);
+            emit imageFileLoaded(path);
+        }
+    });
+    watcher->setFuture(QtConcurrent::run([path, pyramidTransformationMode, isCancelled]() {
+        return readImageFile(path, pyramidTransformationMode, isCancelled);
+    }));
+}
+
+void QResultImageView::cancelImageFileLoading()
+{
+    // Any loads still in flight notice the change, and their results are discarded
+    ++*imageFileGeneration;
+}
+
+QResultImageView::LoadedImageFile QResultImageView::readImageFilePreview(const QString& path, int maxPreviewDimension, const std::function<bool()>& isCancelled)
+{
+    LoadedImageFile preview;
+
+    // Superseded while still queued (e.g., when stepping through a list of files)
+    if (isCancelled()) {
+        return preview;
+    }
+
+    QImageReader reader(path);
+    const QSize fullSize = reader.size();
+
+    if (!fullSize.isValid() || std::max(fullSize.width(), fullSize.height()) <= maxPreviewDimension) {
+        // Either the size isn't known without decoding everything, or the image is small
+        // enough that the full-resolution load is going to be quick anyway
+        return preview;
+    }
+
+    // Reading the header may have taken a while, too
+    if (isCancelled()) {
+        return preview;
+    }
+
+    // Other handlers (e.g., PNG) claim to support ScaledSize as well, but decode everything and scale
+    // afterwards; which would just duplicate the full-resolution load
+    const QByteArray format = reader.format().toLower();
+    const bool decodesAtReducedResolution = format == "jpeg" || format == "jpg";
+
+    if (decodesAtReducedResolution && reader.supportsOption(QImageIOHandler::ScaledSize)) {
+        // JPEG can decode directly at a reduced resolution
+        reader.setScaledSize(fullSize.scaled(maxPreviewDimension, maxPreviewDimension, Qt::KeepAspectRatio));
+        preview.image = reader.read();
     }
     else {
-        sourceImage = QImage();
+        // Some files (e.g., pyramidal TIFF) embed reduced-resolution versions as additional images
+        const auto hasSameAspectRatio = [&fullSize](const QSize& size) {
+            const qint64 crossProductDifference = static_cast<qint64>(size.width()) * fullSize.height() - static_cast<qint64>(size.height()) * fullSize.width();
+            return std::abs(crossProductDifference) <= std::max(fullSize.width(), fullSize.height());
+        };
+
+        for (int i = 1, end = reader.imageCount(); i < end && !isCancelled() && reader.jumpToImage(i); ++i) {
+            const QSize size = reader.size();
+            if (size.isValid() && size.width() < fullSize.width() && hasSameAspectRatio(size)
+                    && std::max(size.width(), size.height()) <= 2 * maxPreviewDimension) {
+                preview.image = reader.read();
+                break;
+            }
+        }
+    }
+
+    if (!preview.image.isNull()) {
+        preview.fullSize = fullSize;
+    }
+
+    return preview;
+}
+
+QResultImageView::LoadedImageFile QResultImageView::readImageFile(const QString& path, Qt::TransformationMode pyramidTransformationMode, const std::function<bool()>& isCancelled)
+{
+    LoadedImageFile loaded;
+
+    // Superseded while still queued; the result is going to be discarded anyway
+    if (isCancelled()) {
+        return loaded;
+    }
+
+    QImageReader reader(path);
+
+    if (!reader.canRead()) {
+        loaded.errorString = reader.errorString();
+        return loaded;
+    }
+
+    // Checked again once the file has been opened, just before decoding everything
+    if (isCancelled()) {
+        return loaded;
+    }
+
+    loaded.image = reader.read();
+
+    if (loaded.image.isNull()) {
+        loaded.errorString = reader.errorString();
     }
+    else if (!isCancelled()) {
+        loaded.fullSize = loaded.image.size();
+        loaded.pyramid = buildSourcePyramid(loaded.image, pyramidTransformationMode);
+        loaded.pyramidTransformationMode = pyramidTransformationMode;
+    }
+
+    return loaded;
+}
+
+void QResultImageView::showImageFilePreview(const LoadedImageFile& preview)
+{
+    sourceImage = QImage();
+    sourceSize = preview.fullSize;
     sourcePixmap = QPixmap();
 
     sourceImagePyramid.clear();
     sourcePixmapPyramid.clear();
 
-    for (size_t i = 1, end = imagePyramid.size(); i < end; ++i) {
-        const double scaleFactor = std::sqrt(imagePyramid[i].width() * imagePyramid[i].height() / static_cast<double>(sourceImage.width() * sourceImage.height()));
-        sourceImagePyramid[scaleFactor] = imagePyramid[i];
-    }
+    // Until the full-resolution image is there, the preview is the only pyramid level
+    const double scaleFactor = std::sqrt(preview.image.width() * preview.image.height() / static_cast<double>(sourceSize.width() * sourceSize.height()));
+    sourceImagePyramid[scaleFactor] = preview.image;
+
+    redrawEverything(Qt::FastTransformation);
+}
+
+void QResultImageView::showLoadedImageFile(LoadedImageFile& loaded)
+{
+    sourceImage = loaded.image;
+    sourceSize = sourceImage.size();
+    sourcePixmap = QPixmap();
 
-    this->results = results;
-    setResultPolygons();
+    if (loaded.pyramidTransformationMode == getPyramidTransformationMode()) {
+        sourceImagePyramid = std::move(loaded.pyramid);
+        sourcePixmapPyramid.clear();
+    }
+    else {
+        // The transformation mode was changed while loading
+        updateSourcePyramid();
+    }
 
     redrawEverything(getEventualTransformationMode());
 }
@@ -93,96 +525,396 @@ void QResultImageView::setTransformationMode(TransformationMode newTransformatio
         transformationMode = newTransformationMode;
 
         if (needToUpdateSourcePyramid) {
-            updateSourcePyramid();
+            // While only a preview is shown, the preview is the only level there is; the full-resolution
+            // image gets its pyramid when loaded (see showLoadedImageFile)
+            if (!sourceImage.isNull()) {
+                updateSourcePyramid();
+            }
+            if (!comparisonImage.isNull()) {
+                comparisonImagePyramid = buildSourcePyramid(comparisonImage, getPyramidTransformationMode());
+            }
         }
 
         redrawEverything(getEventualTransformationMode());
     }
 }
 
-void QResultImageView::paintEvent(QPaintEvent* event)
+void QResultImageView::setComparisonImage(const QImage& image)
 {
-    QPainter painter(this);
-    painter.drawPixmap(destinationRect, scaledAndCroppedSourceWithResults);
+    comparisonImage = image;
 
-    if (!isnan(pixelSize_m)) {
-        drawYardstick(painter);
+    if (!comparisonImage.isNull()) {
+        comparisonImagePyramid = buildSourcePyramid(comparisonImage, getPyramidTransformationMode());
+    }
+    else {
+        comparisonImagePyramid.clear();
+    }
+
+    if (comparisonMode != NoComparison) {
+        redrawEverything(getEventualTransformationMode());
     }
 }
 
-void QResultImageView::mouseMoveEvent(QMouseEvent *event)
+void QResultImageView::setComparisonMode(ComparisonMode mode)
 {
-    const double scaleFactor = getScaleFactor();
-    if (isnan(scaleFactor)) {
-        return;
+    if (mode != comparisonMode) {
+        comparisonMode = mode;
+        redrawEverything(getEventualTransformationMode());
     }
+}
 
-    checkMousePan(event);
-    checkMouseOnResult(event);
+void QResultImageView::setComparisonSplitPosition(double position)
+{
+    position = std::max(0.0, std::min(1.0, position));
 
-    const QPointF sourceCoordinate = screenToSourceActual(event->pos());
+    if (position != comparisonSplitPosition) {
+        comparisonSplitPosition = position;
 
-    // Need to truncate here; rounding isn't the correct thing to do
-    QPoint point(static_cast<int>(sourceCoordinate.x()), static_cast<int>(sourceCoordinate.y()));
-    int pixelIndex = -1;
-    if (sourceImage.valid(point)) {
-        pixelIndex = sourceImage.pixelIndex(point);
+        if (isComparisonActive() && comparisonMode == SplitComparison) {
+            redrawEverything(getInitialTransformationMode());
+            considerActivatingSmoothTransformationTimer();
+        }
     }
-    emit mouseAtCoordinates(sourceCoordinate, pixelIndex);
 }
 
-void QResultImageView::leaveEvent(QEvent*)
+void QResultImageView::setComparisonBlendWeight(double weight)
 {
-    emit mouseLeft();
-}
+    weight = std::max(0.0, std::min(1.0, weight));
 
-void QResultImageView::checkMousePan(const QMouseEvent *event)
-{
-    if (hasPreviousMouseCoordinates) {
-        if (event->buttons() & Qt::LeftButton) {
-            const double imageScaler = getImageScaler();
-            offsetX += (event->x() - previousMouseX) * imageScaler;
-            offsetY += (event->y() - previousMouseY) * imageScaler;
-            limitOffset();
+    if (weight != comparisonBlendWeight) {
+        comparisonBlendWeight = weight;
+
+        if (isComparisonActive() && comparisonMode == BlendComparison) {
             redrawEverything(getInitialTransformationMode());
             considerActivatingSmoothTransformationTimer();
-
-            emit panned();
         }
     }
+}
 
-    hasPreviousMouseCoordinates = true;
-    previousMouseX = event->x();
-    previousMouseY = event->y();
+bool QResultImageView::isComparisonActive() const
+{
+    return comparisonMode != NoComparison
+            && !comparisonImage.isNull()
+            && comparisonImage.size() == sourceSize;
 }
 
-void QResultImageView::checkMouseOnResult(const QMouseEvent *event)
+int QResultImageView::getComparisonSplitX() const
 {
-    const QPointF screenPoint(event->x(), event->y());
-    const QPointF sourcePoint = screenToSourceActual(screenPoint);
+    return static_cast<int>(std::round(comparisonSplitPosition * width()));
+}
 
-    size_t newMouseOnResultIndex = -1;
+bool QResultImageView::isOnComparisonSplit(int x) const
+{
+    const int grabDistance = 4;
+    return isComparisonActive() && comparisonMode == SplitComparison && std::abs(x - getComparisonSplitX()) <= grabDistance;
+}
 
-    for (size_t i = 0, end = resultPolygons.size(); i < end; ++i) {
-        const QPolygonF& polygon = resultPolygons[i];
-        if (polygon.containsPoint(sourcePoint, Qt::OddEvenFill)) {
-            newMouseOnResultIndex = i;
-            break;
-        }
+bool QResultImageView::event(QEvent* event)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6, 6, 0)
+    if (event->type() == QEvent::DevicePixelRatioChange) {
+        checkDevicePixelRatio();
     }
+#endif
 
-    if (newMouseOnResultIndex != mouseOnResultIndex) {
-        if (mouseOnResultIndex != -1 || newMouseOnResultIndex == -1) {
-            emit mouseNotOnResult();
+    return QWidget::event(event);
+}
+
+void QResultImageView::showEvent(QShowEvent* event)
+{
+    // The native window exists by now (and may be a different one, if the view has been reparented)
+    watchWindow();
+
+    QWidget::showEvent(event);
+}
+
+void QResultImageView::watchWindow()
+{
+    QWindow* windowHandle = window()->windowHandle();
+
+    if (windowHandle != watchedWindow) {
+        if (watchedWindow) {
+            disconnect(watchedWindow, nullptr, this, nullptr);
         }
-        if (newMouseOnResultIndex != -1) {
-            emit mouseOnResult(newMouseOnResultIndex);
+
+        watchedWindow = windowHandle;
+
+        if (watchedWindow) {
+            connect(watchedWindow, &QWindow::screenChanged, this, &QResultImageView::watchScreen);
+            watchScreen(watchedWindow->screen());
         }
-        mouseOnResultIndex = newMouseOnResultIndex;
     }
 }
 
-void QResultImageView::wheelEvent(QWheelEvent* event)
+void QResultImageView::watchScreen(QScreen* screen)
+{
+    if (screen != watchedScreen) {
+        if (watchedScreen) {
+            disconnect(watchedScreen, nullptr, this, nullptr);
+        }
+
+        watchedScreen = screen;
+
+        // The scaling of a screen may change, too
+        if (watchedScreen) {
+            connect(watchedScreen, &QScreen::logicalDotsPerInchChanged, this, &QResultImageView::checkDevicePixelRatio);
+            connect(watchedScreen, &QScreen::physicalDotsPerInchChanged, this, &QResultImageView::checkDevicePixelRatio);
+        }
+    }
+
+    checkDevicePixelRatio();
+}
+
+void QResultImageView::checkDevicePixelRatio()
+{
+    if (!isnan(getScaleFactor()) && scaledAndCroppedSource.devicePixelRatioF() != getDevicePixelRatio()) {
+        redrawEverything(getEventualTransformationMode());
+    }
+}
+
+void QResultImageView::paintEvent(QPaintEvent* event)
+{
+    QPainter painter(this);
+
+    // Blit only the part of the viewport that has been exposed
+    const QRect exposedRect = event->rect().intersected(destinationRect);
+    if (!exposedRect.isEmpty() && !scaledAndCroppedSourceWithResults.isNull()) {
+        const double pixmapScaleX = scaledAndCroppedSourceWithResults.width() / static_cast<double>(destinationRect.width());
+        const double pixmapScaleY = scaledAndCroppedSourceWithResults.height() / static_cast<double>(destinationRect.height());
+        const QRectF pixmapRect(
+            (exposedRect.x() - destinationRect.x()) * pixmapScaleX,
+            (exposedRect.y() - destinationRect.y()) * pixmapScaleY,
+            exposedRect.width() * pixmapScaleX,
+            exposedRect.height() * pixmapScaleY
+        );
+        painter.drawPixmap(QRectF(exposedRect), scaledAndCroppedSourceWithResults, pixmapRect);
+    }
+
+    if (isComparisonActive() && comparisonMode == SplitComparison && !destinationRect.isEmpty()) {
+        const int splitX = std::max(destinationRect.left(), std::min(destinationRect.right(), getComparisonSplitX()));
+        painter.setPen(QPen(Qt::white, 1));
+        painter.drawLine(splitX, destinationRect.top(), splitX, destinationRect.bottom());
+    }
+
+    if (resultsVisible && resultLabelsVisible && !results->empty() && !destinationRect.isEmpty()) {
+        drawResultLabels(painter, event->rect());
+    }
+
+    if (isResultHighlighted()) {
+        drawResultHighlight(painter);
+    }
+
+    if (!isnan(pixelSize_m)) {
+        drawYardstick(painter, rect().size(), getImageScaler(), getImageScaler(), pixelSize_m);
+    }
+}
+
+void QResultImageView::mousePressEvent(QMouseEvent* event)
+{
+    // Grabbing the split line moves the line, instead of panning
+    comparisonSplitDragged = event->button() == Qt::LeftButton && isOnComparisonSplit(event->x());
+
+    // Otherwise, the event goes to the parent, as it did before
+    if (!comparisonSplitDragged) {
+        event->ignore();
+    }
+}
+
+void QResultImageView::mouseReleaseEvent(QMouseEvent* event)
+{
+    if (event->button() == Qt::LeftButton && comparisonSplitDragged) {
+        comparisonSplitDragged = false;
+    }
+    else {
+        event->ignore();
+    }
+}
+
+void QResultImageView::mouseMoveEvent(QMouseEvent *event)
+{
+    const double scaleFactor = getScaleFactor();
+    if (isnan(scaleFactor)) {
+        return;
+    }
+
+    if (comparisonSplitDragged && (event->buttons() & Qt::LeftButton)) {
+        setComparisonSplitPosition(event->x() / static_cast<double>(width()));
+        emit comparisonSplitMoved(comparisonSplitPosition);
+
+        // So that releasing the line does not make the view jump
+        previousMouseX = event->x();
+        previousMouseY = event->y();
+    }
+    else {
+        checkMousePan(event);
+    }
+
+    // Any cursor set by the application is left alone, unless over the split line
+    const bool splitCursorNeeded = comparisonSplitDragged || isOnComparisonSplit(event->x());
+    if (splitCursorNeeded != comparisonSplitCursorSet) {
+        if (splitCursorNeeded) {
+            hadPreviousCursor = testAttribute(Qt::WA_SetCursor);
+            previousCursor = cursor();
+            setCursor(Qt::SplitHCursor);
+        }
+        else if (hadPreviousCursor) {
+            setCursor(previousCursor);
+        }
+        else {
+            unsetCursor();
+        }
+        comparisonSplitCursorSet = splitCursorNeeded;
+    }
+
+    checkMouseOnResult(event);
+
+    const QPointF sourceCoordinate = screenToSourceActual(event->pos());
+
+    // Need to truncate here; rounding isn't the correct thing to do
+    QPoint point(static_cast<int>(sourceCoordinate.x()), static_cast<int>(sourceCoordinate.y()));
+    int pixelIndex = -1;
+    if (sourceImage.valid(point)) {
+        pixelIndex = sourceImage.pixelIndex(point);
+    }
+    emit mouseAtCoordinates(sourceCoordinate, pixelIndex);
+}
+
+void QResultImageView::leaveEvent(QEvent*)
+{
+    emit mouseLeft();
+}
+
+void QResultImageView::checkMousePan(const QMouseEvent *event)
+{
+    if (hasPreviousMouseCoordinates) {
+        if (event->buttons() & Qt::LeftButton) {
+            const double imageScaler = getImageScaler();
+            offsetX += (event->x() - previousMouseX) * imageScaler;
+            offsetY += (event->y() - previousMouseY) * imageScaler;
+            limitOffset();
+            redrawEverything(getInitialTransformationMode());
+            considerActivatingSmoothTransformationTimer();
+
+            emit panned();
+        }
+    }
+
+    hasPreviousMouseCoordinates = true;
+    previousMouseX = event->x();
+    previousMouseY = event->y();
+}
+
+void QResultImageView::checkMouseOnResult(const QMouseEvent *event)
+{
+    const QPointF screenPoint(event->x(), event->y());
+    const QPointF sourcePoint = screenToSourceActual(screenPoint);
+
+    size_t newMouseOnResultIndex = -1;
+
+    for (size_t i = 0, end = results->size(); i < end; ++i) {
+        if (!resultVisibility[i] || !resultBoundingRects[i].contains(sourcePoint)) {
+            continue;
+        }
+        if (containsPoint((*results)[i].contour, sourcePoint)) {
+            newMouseOnResultIndex = i;
+            break;
+        }
+    }
+
+    if (newMouseOnResultIndex != mouseOnResultIndex) {
+        if (mouseOnResultIndex != -1 || newMouseOnResultIndex == -1) {
+            emit mouseNotOnResult();
+        }
+        if (newMouseOnResultIndex != -1) {
+            emit mouseOnResult(newMouseOnResultIndex);
+        }
+
+        // Repaint only where the highlight was, and where it is going to be
+        if (isResultHighlighted()) {
+            update(getResultHighlightRect());
+        }
+        mouseOnResultIndex = newMouseOnResultIndex;
+        if (isResultHighlighted()) {
+            update(getResultHighlightRect());
+        }
+    }
+}
+
+void QResultImageView::setResultHighlightPen(const QPen& pen)
+{
+    if (isResultHighlighted()) {
+        update(getResultHighlightRect());
+    }
+    resultHighlightPen = pen;
+    if (isResultHighlighted()) {
+        update(getResultHighlightRect());
+    }
+}
+
+void QResultImageView::resetMouseOnResult()
+{
+    if (mouseOnResultIndex != -1) {
+        if (isResultHighlighted()) {
+            update(getResultHighlightRect());
+        }
+        mouseOnResultIndex = -1;
+        emit mouseNotOnResult();
+    }
+}
+
+bool QResultImageView::isResultHighlighted() const
+{
+    return resultsVisible
+            && resultHighlightPen.style() != Qt::NoPen
+            && mouseOnResultIndex < results->size()
+            && resultVisibility[mouseOnResultIndex]
+            && !destinationRect.isEmpty();
+}
+
+QRect QResultImageView::getResultHighlightRect() const
+{
+    Q_ASSERT(isResultHighlighted());
+
+    const QRectF& sourceRect = resultBoundingRects[mouseOnResultIndex];
+    const int margin = static_cast<int>(std::ceil(std::max(1.0, resultHighlightPen.widthF()) / 2)) + 1;
+    return getSourceToScreenTransform().mapRect(sourceRect).toAlignedRect().adjusted(-margin, -margin, margin, margin);
+}
+
+void QResultImageView::drawResultHighlight(QPainter& painter) const
+{
+    Q_ASSERT(isResultHighlighted());
+
+    const std::vector<QPointF>& contour = (*results)[mouseOnResultIndex].contour;
+    const QTransform transform = getSourceToScreenTransform();
+
+    std::vector<QPointF> screenContour(contour.size());
+    std::transform(contour.begin(), contour.end(), screenContour.begin(), [&transform](const QPointF& point) {
+        return transform.map(point);
+    });
+
+    painter.setPen(resultHighlightPen);
+    painter.setBrush(Qt::NoBrush);
+    painter.drawPolygon(screenContour.data(), static_cast<int>(screenContour.size()));
+}
+
+bool QResultImageView::containsPoint(const std::vector<QPointF>& contour, const QPointF& point)
+{
+    // Odd-even rule: count the edges crossed by a ray from the point to the right
+    bool inside = false;
+
+    for (size_t i = 0, j = contour.size() - 1, end = contour.size(); i < end; j = i++) {
+        const QPointF& a = contour[i];
+        const QPointF& b = contour[j];
+        if ((a.y() > point.y()) != (b.y() > point.y())
+                && point.x() < a.x() + (b.x() - a.x()) * (point.y() - a.y()) / (b.y() - a.y())) {
+            inside = !inside;
+        }
+    }
+
+    return inside;
+}
+
+void QResultImageView::wheelEvent(QWheelEvent* event)
 {
     if (!zoomEnabled) {
         return;
@@ -200,153 +932,531 @@ void QResultImageView::wheelEvent(QWheelEvent* event)
     zoom(newZoomLevel, &point);
 }
 
-void QResultImageView::zoom(int newZoomLevel, const QPointF* screenPoint)
+void QResultImageView::zoom(int newZoomLevel, const QPointF* screenPoint)
+{
+    if (newZoomLevel != zoomLevel) {
+
+        const auto getScreenPoint = [this, screenPoint]() {
+            if (screenPoint) {
+                return QPointF(*screenPoint);
+            }
+            else {
+                const QRect r = rect();
+                return QPointF(r.width() / 2.f, r.height() / 2.f);
+            }
+        };
+
+        const QPointF point = getScreenPoint();
+        QPointF sourcePointBefore = screenToSourceIdeal(point);
+
+        zoomLevel = newZoomLevel;
+
+        const QPointF newScreenPos = sourceToScreenIdeal(sourcePointBefore);
+        const QPointF offsetChange = (newScreenPos - point) * getImageScaler();
+
+        offsetX -= offsetChange.x();
+        offsetY -= offsetChange.y();
+
+        QPointF sourcePointAfter = screenToSourceIdeal(point);
+
+        Q_ASSERT(fabs(sourcePointBefore.x() - sourcePointAfter.x()) < 1e-6 || (isnan(sourcePointBefore.x()) && isnan(sourcePointAfter.x())));
+        Q_ASSERT(fabs(sourcePointBefore.y() - sourcePointAfter.y()) < 1e-6 || (isnan(sourcePointBefore.y()) && isnan(sourcePointAfter.y())));
+
+        limitOffset();
+
+        redrawEverything(getInitialTransformationMode());
+        considerActivatingSmoothTransformationTimer();
+
+        emit zoomed();
+    }
+}
+
+void QResultImageView::setZoomEnabled(bool enabled)
+{
+    zoomEnabled = enabled;
+}
+
+bool QResultImageView::getZoomEnabled() const
+{
+    return zoomEnabled;
+}
+
+void QResultImageView::resizeEvent(QResizeEvent* event)
+{
+    if (!isnan(getScaleFactor())) {
+        redrawEverything(getInitialTransformationMode());
+        considerActivatingSmoothTransformationTimer();
+    }
+}
+
+double QResultImageView::getScaleFactor() const
+{
+    const int srcFullWidth = sourceSize.width();
+    const int srcFullHeight = sourceSize.height();
+
+    const QRect r = rect();
+
+    if (srcFullWidth <= 0 || srcFullHeight <= 0 || r.width() <= 0 || r.height() <= 0) {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+
+    return std::min(1.0, getDevicePixelRatio() / getImageScaler());
+}
+
+double QResultImageView::getDevicePixelRatio() const
+{
+    return devicePixelRatioF();
+}
+
+QPen QResultImageView::getDevicePen(const QPen& pen, double devicePixelRatio)
+{
+    // Cosmetic pens are one device pixel wide anyway
+    if (devicePixelRatio == 1.0 || pen.isCosmetic()) {
+        return pen;
+    }
+
+    QPen devicePen = pen;
+    devicePen.setWidthF(pen.widthF() * devicePixelRatio);
+    return devicePen;
+}
+
+void QResultImageView::redrawEverything(Qt::TransformationMode transformationMode)
+{
+    const double scaleFactor = getScaleFactor();
+
+    if (!isnan(scaleFactor)) {
+        updateViewport(transformationMode);
+        drawResultsToViewport();
+        update();
+    }
+}
+
+std::pair<double, const QPixmap*> QResultImageView::getSourcePixmap(double scaleFactor) const
+{
+    const std::pair<double, const QImage*> level = getPyramidLevel(sourceImage, sourceImagePyramid, scaleFactor);
+
+    if (level.second == &sourceImage) {
+        if (sourcePixmap.width() == 0 && sourcePixmap.height() == 0) {
+            sourcePixmap.convertFromImage(sourceImage);
+        }
+        return std::make_pair(1.0, &sourcePixmap);
+    }
+    else {
+        auto j = sourcePixmapPyramid.find(level.first);
+        if (j == sourcePixmapPyramid.end()) {
+            sourcePixmapPyramid[level.first].convertFromImage(*level.second);
+            j = sourcePixmapPyramid.find(level.first);
+        }
+
+        const QPixmap* correspondingPixmap = &j->second;
+
+        return std::make_pair(level.first, correspondingPixmap);
+    }
+}
+
+std::pair<double, const QImage*> QResultImageView::getPyramidLevel(const QImage& image, const std::map<double, QImage>& pyramid, double scaleFactor)
+{
+    // Without the full-resolution image (say, while a file is still loading), the finest pyramid level has to do
+    const bool fullResolutionAvailable = !image.isNull();
+
+    if (fullResolutionAvailable && (pyramid.empty() || scaleFactor > pyramid.rbegin()->first)) {
+        return std::make_pair(1.0, &image);
+    }
+    else {
+        Q_ASSERT(!pyramid.empty());
+
+        auto i = pyramid.lower_bound(scaleFactor);
+        if (i == pyramid.end()) {
+            --i;
+        }
+
+        return std::make_pair(i->first, &i->second);
+    }
+}
+
+void QResultImageView::drawResultsToViewport()
+{
+    // The labels are drawn in paintEvent, but placed according to the viewport
+    placedResultLabelsValid = false;
+
+    // Whatever was still being rendered progressively is now obsolete
+    progressiveResultRenderingTimer.stop();
+    progressiveResultRenderingPosition = 0;
+
+    if (results->empty() || !resultsVisible) {
+        scaledAndCroppedSourceWithResults = scaledAndCroppedSource;
+    }
+    else {
+        scaledAndCroppedSourceWithResults = scaledAndCroppedSource.copy();
+
+        if (progressiveResultRendering) {
+            // The first slice is drawn right away
+            continueProgressiveResultRendering();
+        }
+        else {
+            const double scaleFactor = getScaleFactor();
+            const QRectF visibleSourceRect = getViewportSourceRect();
+            const QRectF cullingRect = getResultCullingRect(scaleFactor);
+
+            prepareScaledResultPaths(scaleFactor);
+
+            const double devicePixelRatio = scaledAndCroppedSourceWithResults.devicePixelRatioF();
+
+            // The paths are already scaled, so panning is just a translation; and there is one draw call per pen and tile
+            QPainter resultPainter(&scaledAndCroppedSourceWithResults);
+            resultPainter.scale(1.0 / devicePixelRatio, 1.0 / devicePixelRatio);
+            resultPainter.translate(-std::round(visibleSourceRect.left() * scaleFactor), -std::round(visibleSourceRect.top() * scaleFactor));
+            size_t currentPenIndex = -1;
+            for (const ScaledResultPath& scaledPath : scaledResultPaths) {
+                if (!overlaps(scaledPath.sourceBoundingRect, cullingRect)) {
+                    continue;
+                }
+                if (scaledPath.penIndex != currentPenIndex) {
+                    currentPenIndex = scaledPath.penIndex;
+                    resultPainter.setPen(getDevicePen(resultPens[currentPenIndex], devicePixelRatio));
+                }
+                resultPainter.drawPath(scaledPath.path);
+            }
+        }
+    }
+}
+
+void QResultImageView::continueProgressiveResultRendering()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    const double scaleFactor = getScaleFactor();
+    const QRectF visibleSourceRect = getViewportSourceRect();
+    const QRectF cullingRect = getResultCullingRect(scaleFactor);
+
+    prepareScaledResultPolygons(scaleFactor);
+
+    const double devicePixelRatio = scaledAndCroppedSourceWithResults.devicePixelRatioF();
+
+    // The polygons are in device pixels
+    QPainter resultPainter(&scaledAndCroppedSourceWithResults);
+    resultPainter.scale(1.0 / devicePixelRatio, 1.0 / devicePixelRatio);
+    resultPainter.translate(-std::round(visibleSourceRect.left() * scaleFactor), -std::round(visibleSourceRect.top() * scaleFactor));
+
+    const size_t end = resultDrawOrder.size();
+    size_t& position = progressiveResultRenderingPosition;
+    size_t currentPenIndex = -1;
+
+    while (position < end) {
+        const size_t i = resultDrawOrder[position++];
+        if (resultVisibility[i] && overlaps(resultBoundingRects[i], cullingRect)) {
+            if (resultPenIndices[i] != currentPenIndex) {
+                currentPenIndex = resultPenIndices[i];
+                resultPainter.setPen(getDevicePen(resultPens[currentPenIndex], devicePixelRatio));
+            }
+            resultPainter.drawPolygon(getScaledResultPolygon(i));
+        }
+
+        // Checking the clock for every single result would be unnecessarily expensive
+        if (position % 16 == 0 && timer.hasExpired(progressiveResultRenderingSliceBudget_ms)) {
+            break;
+        }
+    }
+
+    resultPainter.end();
+
+    // Show what has been accumulated so far
+    update(destinationRect);
+
+    if (position < end) {
+        progressiveResultRenderingTimer.start();
+    }
+}
+
+void QResultImageView::drawResultToViewport(QPainter& painter, const Result& result, const QPointF& sourceTopLeft, double scaleFactorX, double scaleFactorY)
+{
+    painter.setPen(result.pen);
+    if (!result.contour.empty()) {
+        std::vector<QPoint> scaledContour(result.contour.size());
+        for (size_t i = 0, end = result.contour.size(); i < end; ++i) {
+            const QPointF& point = result.contour[i];
+            QPoint& scaledPoint = scaledContour[i];
+            // scaled first, so that there is no rounding error to magnify
+            scaledPoint.setX(static_cast<int>(std::round((point.x() - sourceTopLeft.x()) * scaleFactorX)));
+            scaledPoint.setY(static_cast<int>(std::round((point.y() - sourceTopLeft.y()) * scaleFactorY)));
+        }
+        painter.drawPolygon(scaledContour.data(), static_cast<int>(scaledContour.size()));
+    }
+}
+
+void QResultImageView::drawResultLabels(QPainter& painter, const QRect& exposedRect)
+{
+    if (font() != resultLabelFont) {
+        // The cached layouts are no longer valid
+        resultLabelFont = font();
+        resultLabelTexts.assign(results->size(), QStaticText());
+        placedResultLabelsValid = false;
+    }
+
+    if (!placedResultLabelsValid) {
+        const auto getLabelSize = [this](size_t i) {
+            QStaticText& text = resultLabelTexts[i];
+            if (text.text().isEmpty()) {
+                text.setText((*results)[i].label);
+                text.setTextFormat(Qt::PlainText);
+                text.setPerformanceHint(QStaticText::AggressiveCaching);
+                text.prepare(QTransform(), resultLabelFont);
+            }
+            return text.size();
+        };
+
+        // Placed in screen space, so that neither the text nor the collision grid grows when zooming in
+        const QTransform transform = getSourceToScreenTransform();
+        const QRectF visibleSourceRect = transform.inverted().mapRect(QRectF(destinationRect));
+
+        placedResultLabels = placeResultLabels(*results, resultBoundingRects, resultDrawOrder, resultVisibility, visibleSourceRect, transform.m11(), transform.m22(), destinationRect.size(), getLabelSize);
+        placedResultLabelsValid = true;
+    }
+
+    painter.setFont(resultLabelFont);
+    for (const PlacedLabel& placedLabel : placedResultLabels) {
+        const QStaticText& text = resultLabelTexts[placedLabel.resultIndex];
+        const QPointF position = placedLabel.position + destinationRect.topLeft();
+        if (QRectF(position, text.size()).intersects(exposedRect)) {
+            painter.setPen((*results)[placedLabel.resultIndex].pen.color());
+            painter.drawStaticText(position, text);
+        }
+    }
+}
+
+std::vector<QResultImageView::PlacedLabel> QResultImageView::placeResultLabels(const Results& results, const std::vector<QRectF>& resultBoundingRects, const std::vector<size_t>& resultDrawOrder, const std::vector<bool>& resultVisibility, const QRectF& sourceRect, double scaleFactorX, double scaleFactorY, const QSize& outputSize, const std::function<QSizeF(size_t)>& getLabelSize)
+{
+    std::vector<PlacedLabel> placedLabels;
+
+    // A label is placed only if none of the grid cells it touches has been taken yet. So however many
+    // results there are, the number of labels drawn is limited by the output size.
+    const int cellSize = 8;
+    const int columns = (outputSize.width() + cellSize - 1) / cellSize;
+    const int rows = (outputSize.height() + cellSize - 1) / cellSize;
+    std::vector<bool> occupied(static_cast<size_t>(columns) * rows);
+
+    const auto forEachCell = [columns, rows, cellSize](const QRectF& rect, const std::function<bool(size_t)>& function) {
+        // a label clamped to the right or bottom edge ends exactly on the edge, which is not in any cell
+        const int left = static_cast<int>(rect.left()) / cellSize;
+        const int right = std::min(columns - 1, static_cast<int>(rect.right()) / cellSize);
+        const int top = static_cast<int>(rect.top()) / cellSize;
+        const int bottom = std::min(rows - 1, static_cast<int>(rect.bottom()) / cellSize);
+        for (int row = top; row <= bottom; ++row) {
+            for (int column = left; column <= right; ++column) {
+                if (!function(static_cast<size_t>(row) * columns + column)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    };
+
+    // the most important (that is, largest) results get to go first
+    for (size_t i : resultDrawOrder) {
+        if (!resultVisibility[i] || results[i].label.isEmpty() || !overlaps(resultBoundingRects[i], sourceRect)) {
+            continue;
+        }
+
+        const QSizeF labelSize = getLabelSize(i);
+        if (labelSize.width() >= outputSize.width() || labelSize.height() >= outputSize.height()) {
+            continue;
+        }
+
+        // just above the top-left corner of the result, but within the output
+        const double x = (resultBoundingRects[i].left() - sourceRect.left()) * scaleFactorX;
+        const double y = (resultBoundingRects[i].top() - sourceRect.top()) * scaleFactorY - labelSize.height();
+        const QPointF position(
+            std::max(0.0, std::min(x, outputSize.width() - labelSize.width())),
+            std::max(0.0, std::min(y, outputSize.height() - labelSize.height()))
+        );
+        const QRectF labelRect(position, labelSize);
+
+        const bool isFree = forEachCell(labelRect, [&occupied](size_t cell) { return !occupied[cell]; });
+        if (isFree) {
+            forEachCell(labelRect, [&occupied](size_t cell) { occupied[cell] = true; return true; });
+            placedLabels.push_back(PlacedLabel{ i, position });
+        }
+    }
+
+    return placedLabels;
+}
+
+void QResultImageView::setScaledResultCacheScaleFactor(double scaleFactor)
+{
+    if (scaleFactor != scaledResultCacheScaleFactor) {
+        scaledResultCacheScaleFactor = scaleFactor;
+        scaledResultPolygons.clear();
+        scaledResultPaths.clear();
+    }
+}
+
+void QResultImageView::prepareScaledResultPolygons(double scaleFactor)
+{
+    setScaledResultCacheScaleFactor(scaleFactor);
+
+    // the polygons themselves are scaled only when first drawn, within the slice budget
+    scaledResultPolygons.resize(results->size());
+}
+
+const QPolygon& QResultImageView::getScaledResultPolygon(size_t resultIndex)
+{
+    const std::vector<QPointF>& contour = (*results)[resultIndex].contour;
+    QPolygon& scaledPolygon = scaledResultPolygons[resultIndex];
+
+    // not scaled yet, unless the sizes match
+    if (scaledPolygon.size() != static_cast<int>(contour.size())) {
+        const double scaleFactor = scaledResultCacheScaleFactor;
+        scaledPolygon.resize(static_cast<int>(contour.size()));
+        for (size_t j = 0, end = contour.size(); j < end; ++j) {
+            const QPointF& point = contour[j];
+            scaledPolygon[static_cast<int>(j)] = QPoint(static_cast<int>(std::round(point.x() * scaleFactor)), static_cast<int>(std::round(point.y() * scaleFactor)));
+        }
+    }
+
+    return scaledPolygon;
+}
+
+void QResultImageView::prepareScaledResultPaths(double scaleFactor)
 {
-    if (newZoomLevel != zoomLevel) {
+    setScaledResultCacheScaleFactor(scaleFactor);
 
-        const auto getScreenPoint = [this, screenPoint]() {
-            if (screenPoint) {
-                return QPointF(*screenPoint);
-            }
-            else {
-                const QRect r = rect();
-                return QPointF(r.width() / 2.f, r.height() / 2.f);
-            }
-        };
+    if (!scaledResultPaths.empty()) {
+        return;
+    }
 
-        const QPointF point = getScreenPoint();
-        QPointF sourcePointBefore = screenToSourceIdeal(point);
+    // The contours are scaled once per scale factor; when only the filter changes, just the batches are rebuilt
+    prepareScaledResultPolygons(scaleFactor);
 
-        zoomLevel = newZoomLevel;
+    // One path per pen and tile, holding the visible results of that pen centered in that tile. So the draw calls
+    // are still batched, but the paths outside the viewport can be skipped; and panning does not rebuild anything.
+    const double tileSize = 512 / scaleFactor; // in source pixels
 
-        const QPointF newScreenPos = sourceToScreenIdeal(sourcePointBefore);
-        const QPointF offsetChange = (newScreenPos - point) * getImageScaler();
+    typedef std::pair<size_t, std::pair<int, int>> PathKey; // pen index first, so that the paths end up grouped by pen
+    std::map<PathKey, ScaledResultPath> paths;
 
-        offsetX -= offsetChange.x();
-        offsetY -= offsetChange.y();
+    for (size_t i = 0, end = results->size(); i < end; ++i) {
+        if (!resultVisibility[i] || (*results)[i].contour.empty()) {
+            continue;
+        }
 
-        QPointF sourcePointAfter = screenToSourceIdeal(point);
+        const QRectF& boundingRect = resultBoundingRects[i];
+        const PathKey key(resultPenIndices[i], std::make_pair(
+            static_cast<int>(std::floor(boundingRect.center().x() / tileSize)),
+            static_cast<int>(std::floor(boundingRect.center().y() / tileSize))
+        ));
 
-        Q_ASSERT(fabs(sourcePointBefore.x() - sourcePointAfter.x()) < 1e-6 || (isnan(sourcePointBefore.x()) && isnan(sourcePointAfter.x())));
-        Q_ASSERT(fabs(sourcePointBefore.y() - sourcePointAfter.y()) < 1e-6 || (isnan(sourcePointBefore.y()) && isnan(sourcePointAfter.y())));
+        auto j = paths.find(key);
+        if (j == paths.end()) {
+            j = paths.insert(std::make_pair(key, ScaledResultPath{ resultPenIndices[i], boundingRect, QPainterPath() })).first;
+        }
 
-        limitOffset();
+        ScaledResultPath& scaledPath = j->second;
 
-        redrawEverything(getInitialTransformationMode());
-        considerActivatingSmoothTransformationTimer();
+        // not QRectF::united, which ignores rects without a size (e.g., a single point)
+        QRectF& pathRect = scaledPath.sourceBoundingRect;
+        pathRect.setCoords(
+            std::min(pathRect.left(), boundingRect.left()), std::min(pathRect.top(), boundingRect.top()),
+            std::max(pathRect.right(), boundingRect.right()), std::max(pathRect.bottom(), boundingRect.bottom())
+        );
 
-        emit zoomed();
+        const QPolygon& scaledPolygon = getScaledResultPolygon(i);
+        QPainterPath& path = scaledPath.path;
+        path.moveTo(scaledPolygon.front());
+        for (int k = 1, end = scaledPolygon.size(); k < end; ++k) {
+            path.lineTo(scaledPolygon[k]);
+        }
+        path.closeSubpath();
     }
-}
 
-void QResultImageView::setZoomEnabled(bool enabled)
-{
-    zoomEnabled = enabled;
+    scaledResultPaths.reserve(paths.size());
+    for (auto& path : paths) {
+        scaledResultPaths.push_back(std::move(path.second));
+    }
 }
 
-bool QResultImageView::getZoomEnabled() const
+QRectF QResultImageView::getResultCullingRect(double scaleFactor) const
 {
-    return zoomEnabled;
+    // Results just outside the viewport may still reach into it with their strokes
+    const double margin = getMaxPenWidth(resultPens) / 2 * getDevicePixelRatio() / scaleFactor + 1;
+    return getViewportSourceRect().adjusted(-margin, -margin, margin, margin);
 }
 
-void QResultImageView::resizeEvent(QResizeEvent* event)
+double QResultImageView::getMaxPenWidth(const std::vector<QPen>& pens)
 {
-    if (!isnan(getScaleFactor())) {
-        redrawEverything(getInitialTransformationMode());
-        considerActivatingSmoothTransformationTimer();
+    double maxPenWidth = 1.0; // cosmetic pens, or zero width
+    for (const QPen& pen : pens) {
+        if (!pen.isCosmetic()) {
+            maxPenWidth = std::max(maxPenWidth, pen.widthF());
+        }
     }
+    return maxPenWidth;
 }
 
-double QResultImageView::getScaleFactor() const
+QRectF QResultImageView::getViewportSourceRect() const
 {
-    const int srcFullWidth = sourceImage.width();
-    const int srcFullHeight = sourceImage.height();
+    const double zoomCenterX = sourceSize.width() / 2 - offsetX;
+    const double zoomCenterY = sourceSize.height() / 2 - offsetY;
 
-    const QRect r = rect();
+    const double srcVisibleWidth = getSourceImageVisibleWidth();
+    const double srcVisibleHeight = getSourceImageVisibleHeigth();
 
-    if (srcFullWidth <= 0 || srcFullHeight <= 0 || r.width() <= 0 || r.height() <= 0) {
-        return std::numeric_limits<double>::quiet_NaN();
-    }
+    const double srcLeft = std::max(0.0, zoomCenterX - srcVisibleWidth / 2);
+    const double srcRight = std::min(static_cast<double>(sourceSize.width()), srcLeft + srcVisibleWidth);
+    const double srcTop = std::max(0.0, zoomCenterY - srcVisibleHeight / 2);
+    const double srcBottom = std::min(static_cast<double>(sourceSize.height()), srcTop + srcVisibleHeight);
 
-    return std::min(1.0, 1.0 / getImageScaler());
+    return QRectF(QPointF(srcLeft, srcTop), QPointF(srcRight, srcBottom));
 }
 
-void QResultImageView::redrawEverything(Qt::TransformationMode transformationMode)
+void QResultImageView::setResultFilter(quint64 categoryMask, double minimumScore)
 {
-    const double scaleFactor = getScaleFactor();
-
-    if (!isnan(scaleFactor)) {
-        updateViewport(transformationMode);
-        drawResultsToViewport();
-        update();
+    if (categoryMask == resultCategoryMask && minimumScore == resultMinimumScore) {
+        return;
     }
-}
 
-std::pair<double, const QPixmap*> QResultImageView::getSourcePixmap(double scaleFactor) const
-{
-    if (scaleFactor > sourceImagePyramid.rbegin()->first) {
-        if (sourcePixmap.width() == 0 && sourcePixmap.height() == 0) {
-            sourcePixmap.convertFromImage(sourceImage);
-        }
-        return std::make_pair(1.0, &sourcePixmap);
+    if (isResultHighlighted()) {
+        update(getResultHighlightRect());
     }
-    else {
-        auto i = sourceImagePyramid.begin();
-        double foundScaleFactor = i->first;
-        const QImage* correspondingImage = &i->second;
-        while (scaleFactor > i->first) {
-            Q_ASSERT(i != sourceImagePyramid.end());
-            ++i;
-            foundScaleFactor = i->first;
-            correspondingImage = &i->second;
-        }
-        Q_ASSERT(i != sourceImagePyramid.end());
-
-        auto j = sourcePixmapPyramid.find(foundScaleFactor);
-        if (j == sourcePixmapPyramid.end()) {
-            sourcePixmapPyramid[foundScaleFactor].convertFromImage(*correspondingImage);
-            j = sourcePixmapPyramid.find(foundScaleFactor);
-        }
 
-        const QPixmap* correspondingPixmap = &j->second;
+    resultCategoryMask = categoryMask;
+    resultMinimumScore = minimumScore;
 
-        return std::make_pair(foundScaleFactor, correspondingPixmap);
-    }
-}
+    // Only the overlay needs to be redrawn; the polygons and the viewport stay as they are
+    updateResultVisibility();
 
-void QResultImageView::drawResultsToViewport()
-{
-    if (results.empty() || !resultsVisible) {
-        scaledAndCroppedSourceWithResults = scaledAndCroppedSource;
+    if (mouseOnResultIndex < resultVisibility.size() && !resultVisibility[mouseOnResultIndex]) {
+        mouseOnResultIndex = -1;
+        emit mouseNotOnResult();
     }
-    else {
-        scaledAndCroppedSourceWithResults = scaledAndCroppedSource.copy();
 
-        const double scaleFactor = getScaleFactor();
+    if (!results->empty()) {
+        drawResultsToViewport();
+        update(destinationRect);
+    }
+}
 
-        const double zoomCenterX = sourceImage.width() / 2 - offsetX;
-        const double zoomCenterY = sourceImage.height() / 2 - offsetY;
+void QResultImageView::setResultLabelsVisible(bool visible)
+{
+    if (resultLabelsVisible != visible) {
+        resultLabelsVisible = visible;
 
-        const double srcVisibleWidth = getSourceImageVisibleWidth();
-        const double srcVisibleHeight = getSourceImageVisibleHeigth();
+        // The labels are not part of the viewport pixmap
+        if (!results->empty()) {
+            update(destinationRect);
+        }
+    }
+}
 
-        const double srcLeft = std::max(0.0, zoomCenterX - srcVisibleWidth / 2);
-        const double srcTop = std::max(0.0, zoomCenterY - srcVisibleHeight / 2);
+void QResultImageView::setProgressiveResultRendering(bool enabled, int sliceBudgetMilliseconds)
+{
+    progressiveResultRendering = enabled;
+    progressiveResultRenderingSliceBudget_ms = sliceBudgetMilliseconds;
 
-        QPainter resultPainter(&scaledAndCroppedSourceWithResults);
-        for (const Result& result : results) {
-            resultPainter.setPen(result.pen);
-            if (!result.contour.empty()) {
-                std::vector<QPoint> scaledContour(result.contour.size());
-                for (size_t i = 0, end = result.contour.size(); i < end; ++i) {
-                    const QPointF& point = result.contour[i];
-                    QPoint& scaledPoint = scaledContour[i];
-                    scaledPoint.setX(static_cast<int>(std::round(point.x() - srcLeft) * scaleFactor));
-                    scaledPoint.setY(static_cast<int>(std::round(point.y() - srcTop) * scaleFactor));
-                }
-                resultPainter.drawPolygon(scaledContour.data(), static_cast<int>(scaledContour.size()));
-            }
-        }
+    if (!enabled && progressiveResultRenderingTimer.isActive()) {
+        // Finish right away
+        drawResultsToViewport();
+        update(destinationRect);
     }
 }
 
@@ -358,20 +1468,20 @@ void QResultImageView::updateViewport(Qt::TransformationMode transformationMode)
 
     const std::pair<double, const QPixmap*> scaledSource = getSourcePixmap(scaleFactor);
 
-    const double zoomCenterX = sourceImage.width() / 2 - offsetX;
-    const double zoomCenterY = sourceImage.height() / 2 - offsetY;
+    const double zoomCenterX = sourceSize.width() / 2 - offsetX;
+    const double zoomCenterY = sourceSize.height() / 2 - offsetY;
 
     const double srcVisibleWidth = getSourceImageVisibleWidth();
     const double srcVisibleHeight = getSourceImageVisibleHeigth();
 
     // these two should be approximately equal
-    const double sourceScaleFactorX = scaledSource.second->width() / static_cast<double>(sourceImage.width());
-    const double sourceScaleFactorY = scaledSource.second->height() / static_cast<double>(sourceImage.height());
+    const double sourceScaleFactorX = scaledSource.second->width() / static_cast<double>(sourceSize.width());
+    const double sourceScaleFactorY = scaledSource.second->height() / static_cast<double>(sourceSize.height());
 
     const double srcLeft = std::max(0.0, zoomCenterX - srcVisibleWidth / 2);
-    const double srcRight = std::min(static_cast<double>(sourceImage.width()), srcLeft + srcVisibleWidth);
+    const double srcRight = std::min(static_cast<double>(sourceSize.width()), srcLeft + srcVisibleWidth);
     const double srcTop = std::max(0.0, zoomCenterY - srcVisibleHeight / 2);
-    const double srcBottom = std::min(static_cast<double>(sourceImage.height()), srcTop + srcVisibleHeight);
+    const double srcBottom = std::min(static_cast<double>(sourceSize.height()), srcTop + srcVisibleHeight);
 
     const double scaledSourceLeft = srcLeft * sourceScaleFactorX;
     const double scaledSourceRight = srcRight * sourceScaleFactorX;
@@ -406,13 +1516,157 @@ void QResultImageView::updateViewport(Qt::TransformationMode transformationMode)
     };
 
     croppedSourceRect = roundedRect(scaledSourceTopLeft, scaledSourceBottomRight);
-    croppedSource = scaledSource.second->copy(croppedSourceRect);
+    destinationRect = roundedRect(dstTopLeft, dstBottomRight);
+
+    if (isComparisonActive()) {
+        croppedSource = QPixmap::fromImage(getComparisonCrop(scaleFactor, croppedSourceRect));
+    }
+    else {
+        croppedSource = scaledSource.second->copy(croppedSourceRect);
+    }
 
-    const int scaledWidth = static_cast<int>(std::round(scaleFactor / scaledSource.first * croppedSource.width()));
-    const int scaledHeight = static_cast<int>(std::round(scaleFactor / scaledSource.first * croppedSource.height()));
-    scaledAndCroppedSource = croppedSource.scaled(QSize(scaledWidth, scaledHeight), Qt::IgnoreAspectRatio, transformationMode);
+    const double devicePixelRatio = getDevicePixelRatio();
 
-    destinationRect = roundedRect(dstTopLeft, dstBottomRight);
+    QSize scaledSize(
+        static_cast<int>(std::round(scaleFactor / scaledSource.first * croppedSource.width())),
+        static_cast<int>(std::round(scaleFactor / scaledSource.first * croppedSource.height()))
+    );
+
+    if (scaleFactor < 1.0) {
+        // Exactly one pixel per physical screen pixel, so that paintEvent does not need to resample again
+        scaledSize = QSize(
+            static_cast<int>(std::round(destinationRect.width() * devicePixelRatio)),
+            static_cast<int>(std::round(destinationRect.height() * devicePixelRatio))
+        );
+    }
+
+    scaledAndCroppedSource = croppedSource.scaled(scaledSize, Qt::IgnoreAspectRatio, transformationMode);
+    scaledAndCroppedSource.setDevicePixelRatio(devicePixelRatio);
+}
+
+// output = (a * (256 - weight) + b * weight) / 256, for each channel; output may be the same as a
+static void blendPixels(const QRgb* a, const QRgb* b, QRgb* output, int count, int weight)
+{
+    const uchar* aBytes = reinterpret_cast<const uchar*>(a);
+    const uchar* bBytes = reinterpret_cast<const uchar*>(b);
+    uchar* outputBytes = reinterpret_cast<uchar*>(output);
+    const int byteCount = 4 * count;
+
+    int i = 0;
+
+#ifdef QRESULTIMAGEVIEW_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i aWeight = _mm_set1_epi16(static_cast<short>(256 - weight));
+    const __m128i bWeight = _mm_set1_epi16(static_cast<short>(weight));
+
+    // 16 bytes at a time; the 16-bit sums cannot overflow, as 255 * 256 < 65536
+    for (; i + 16 <= byteCount; i += 16) {
+        const __m128i aValues = _mm_loadu_si128(reinterpret_cast<const __m128i*>(aBytes + i));
+        const __m128i bValues = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bBytes + i));
+
+        const __m128i low = _mm_srli_epi16(_mm_add_epi16(
+            _mm_mullo_epi16(_mm_unpacklo_epi8(aValues, zero), aWeight),
+            _mm_mullo_epi16(_mm_unpacklo_epi8(bValues, zero), bWeight)), 8);
+        const __m128i high = _mm_srli_epi16(_mm_add_epi16(
+            _mm_mullo_epi16(_mm_unpackhi_epi8(aValues, zero), aWeight),
+            _mm_mullo_epi16(_mm_unpackhi_epi8(bValues, zero), bWeight)), 8);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(outputBytes + i), _mm_packus_epi16(low, high));
+    }
+#endif
+
+    for (; i < byteCount; ++i) {
+        outputBytes[i] = static_cast<uchar>((aBytes[i] * (256 - weight) + bBytes[i] * weight) >> 8);
+    }
+}
+
+// output = |a - b|, for each color channel; output may be the same as a
+static void absoluteDifferencePixels(const QRgb* a, const QRgb* b, QRgb* output, int count)
+{
+    int i = 0;
+
+#ifdef QRESULTIMAGEVIEW_SSE2
+    const __m128i opaque = _mm_set1_epi32(static_cast<int>(0xff000000));
+
+    // 4 pixels at a time; with saturating subtraction, one of the two differences is always zero
+    for (; i + 4 <= count; i += 4) {
+        const __m128i aValues = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        const __m128i bValues = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        const __m128i difference = _mm_or_si128(_mm_subs_epu8(aValues, bValues), _mm_subs_epu8(bValues, aValues));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), _mm_or_si128(difference, opaque));
+    }
+#endif
+
+    for (; i < count; ++i) {
+        output[i] = qRgb(
+            std::abs(qRed(a[i]) - qRed(b[i])),
+            std::abs(qGreen(a[i]) - qGreen(b[i])),
+            std::abs(qBlue(a[i]) - qBlue(b[i]))
+        );
+    }
+}
+
+QImage QResultImageView::getComparisonCrop(double scaleFactor, const QRect& rect) const
+{
+    Q_ASSERT(isComparisonActive());
+
+    // The same level as in getSourcePixmap, but the pixel data is needed
+    const std::pair<double, const QImage*> sourceLevel = getPyramidLevel(sourceImage, sourceImagePyramid, scaleFactor);
+    const std::pair<double, const QImage*> comparisonLevel = getPyramidLevel(comparisonImage, comparisonImagePyramid, scaleFactor);
+
+    QImage crop = sourceLevel.second->copy(rect).convertToFormat(QImage::Format_RGB32);
+    QImage comparisonCrop;
+
+    if (comparisonLevel.second->size() == sourceLevel.second->size()) {
+        comparisonCrop = comparisonLevel.second->copy(rect).convertToFormat(QImage::Format_RGB32);
+    }
+    else {
+        // The levels differ if the source pyramid was supplied by the caller (or while a file is still loading)
+        const double scaleX = comparisonLevel.second->width() / static_cast<double>(sourceLevel.second->width());
+        const double scaleY = comparisonLevel.second->height() / static_cast<double>(sourceLevel.second->height());
+        const QRect comparisonRect = QRectF(rect.x() * scaleX, rect.y() * scaleY, rect.width() * scaleX, rect.height() * scaleY).toAlignedRect();
+        comparisonCrop = comparisonLevel.second->copy(comparisonRect).scaled(crop.size(), Qt::IgnoreAspectRatio, Qt::FastTransformation).convertToFormat(QImage::Format_RGB32);
+    }
+
+    if (crop.isNull() || comparisonCrop.size() != crop.size()) {
+        return crop;
+    }
+
+    const int width = crop.width();
+
+    if (comparisonMode == SplitComparison) {
+        // The split line is in widget coordinates
+        const double cropPixelsPerScreenPixel = rect.width() / static_cast<double>(std::max(1, destinationRect.width()));
+        const int splitColumn = std::max(0, std::min(width, static_cast<int>(std::round((getComparisonSplitX() - destinationRect.x()) * cropPixelsPerScreenPixel))));
+
+        for (int y = 0, height = crop.height(); y < height && splitColumn < width; ++y) {
+            QRgb* line = reinterpret_cast<QRgb*>(crop.scanLine(y));
+            const QRgb* comparisonLine = reinterpret_cast<const QRgb*>(comparisonCrop.constScanLine(y));
+            std::copy(comparisonLine + splitColumn, comparisonLine + width, line + splitColumn);
+        }
+    }
+    else if (comparisonMode == BlendComparison) {
+        const int weight = static_cast<int>(std::round(comparisonBlendWeight * 256));
+
+        for (int y = 0, height = crop.height(); y < height; ++y) {
+            QRgb* line = reinterpret_cast<QRgb*>(crop.scanLine(y));
+            blendPixels(line, reinterpret_cast<const QRgb*>(comparisonCrop.constScanLine(y)), line, width, weight);
+        }
+    }
+    else if (comparisonMode == DifferenceComparison) {
+        for (int y = 0, height = crop.height(); y < height; ++y) {
+            QRgb* line = reinterpret_cast<QRgb*>(crop.scanLine(y));
+            absoluteDifferencePixels(line, reinterpret_cast<const QRgb*>(comparisonCrop.constScanLine(y)), line, width);
+        }
+    }
+
+    return crop;
+}
+
+bool QResultImageView::overlaps(const QRectF& a, const QRectF& b)
+{
+    // unlike QRectF::intersects, this accepts rectangles with a zero width or height (e.g., a straight line)
+    return a.left() <= b.right() && b.left() <= a.right() && a.top() <= b.bottom() && b.top() <= a.bottom();
 }
 
 double QResultImageView::getSourceImageVisibleWidth() const
@@ -429,14 +1683,14 @@ double QResultImageView::getSourceImageVisibleHeigth() const
 
 double QResultImageView::getDefaultMagnification() const
 {
-    if (sourceImage.size().isEmpty()) {
+    if (sourceSize.isEmpty()) {
         return 1.0;
     }
 
     const QRect r = rect();
 
-    const double magnificationX = sourceImage.width() / static_cast<double>(r.width());
-    const double magnificationY = sourceImage.height() / static_cast<double>(r.height());
+    const double magnificationX = sourceSize.width() / static_cast<double>(r.width());
+    const double magnificationY = sourceSize.height() / static_cast<double>(r.height());
     const double magnification = std::max(magnificationX, magnificationY);
 
     return magnification;
@@ -467,21 +1721,21 @@ double QResultImageView::getImageScaler() const
 int QResultImageView::getMaxZoomLevel() const
 {
     const int maxZoomLevelMultiplier = 4; // largely empirical
-    return maxZoomLevelMultiplier * std::max(0, std::min(sourceImage.width(), sourceImage.height()));
+    return maxZoomLevelMultiplier * std::max(0, std::min(sourceSize.width(), sourceSize.height()));
 }
 
 void QResultImageView::limitOffset()
 {
-    offsetX = std::max(-sourceImage.width() / 2.0, std::min(sourceImage.width() / 2.0, offsetX));
-    offsetY = std::max(-sourceImage.height() / 2.0, std::min(sourceImage.height() / 2.0, offsetY));
+    offsetX = std::max(-sourceSize.width() / 2.0, std::min(sourceSize.width() / 2.0, offsetX));
+    offsetY = std::max(-sourceSize.height() / 2.0, std::min(sourceSize.height() / 2.0, offsetY));
 }
 
 QPointF QResultImageView::screenToSourceIdeal(const QPointF& screenPoint) const
 {
     const double imageScaler = getImageScaler();
     const QRect r(rect());
-    qreal sourceX = screenPoint.x() * imageScaler - (r.width() * imageScaler - sourceImage.width()) / 2 - offsetX;
-    qreal sourceY = screenPoint.y() * imageScaler - (r.height() * imageScaler - sourceImage.height()) / 2 - offsetY;
+    qreal sourceX = screenPoint.x() * imageScaler - (r.width() * imageScaler - sourceSize.width()) / 2 - offsetX;
+    qreal sourceY = screenPoint.y() * imageScaler - (r.height() * imageScaler - sourceSize.height()) / 2 - offsetY;
     return QPointF(sourceX, sourceY);
 }
 
@@ -489,8 +1743,8 @@ QPointF QResultImageView::sourceToScreenIdeal(const QPointF& sourcePoint) const
 {
     const double imageScaler = getImageScaler();
     const QRect r(rect());
-    qreal screenX = (r.width() - sourceImage.width() / imageScaler) / 2 + (sourcePoint.x() + offsetX) / imageScaler;
-    qreal screenY = (r.height() - sourceImage.height() / imageScaler) / 2 + (sourcePoint.y() + offsetY) / imageScaler;
+    qreal screenX = (r.width() - sourceSize.width() / imageScaler) / 2 + (sourcePoint.x() + offsetX) / imageScaler;
+    qreal screenY = (r.height() - sourceSize.height() / imageScaler) / 2 + (sourcePoint.y() + offsetY) / imageScaler;
     return QPointF(screenX, screenY);
 }
 
@@ -503,8 +1757,8 @@ QPointF QResultImageView::screenToSourceActual(const QPointF& screenPoint) const
     const std::pair<double, const QPixmap*> scaledSource = getSourcePixmap(scaleFactor);
 
     // these two should be approximately equal
-    const double sourceScaleFactorX = scaledSource.second->width() / static_cast<double>(sourceImage.width());
-    const double sourceScaleFactorY = scaledSource.second->height() / static_cast<double>(sourceImage.height());
+    const double sourceScaleFactorX = scaledSource.second->width() / static_cast<double>(sourceSize.width());
+    const double sourceScaleFactorY = scaledSource.second->height() / static_cast<double>(sourceSize.height());
 
     const qreal sourceX = (screenPoint.x() - destinationRect.x()) * croppedSourceRect.width() / sourceScaleFactorX / destinationRect.width() + croppedSourceRect.x() / sourceScaleFactorX;
     const qreal sourceY = (screenPoint.y() - destinationRect.y()) * croppedSourceRect.height() / sourceScaleFactorY / destinationRect.height() + croppedSourceRect.y() / sourceScaleFactorY;
@@ -521,8 +1775,8 @@ QPointF QResultImageView::sourceToScreenActual(const QPointF& sourcePoint) const
     const std::pair<double, const QPixmap*> scaledSource = getSourcePixmap(scaleFactor);
 
     // these two should be approximately equal
-    const double sourceScaleFactorX = scaledSource.second->width() / static_cast<double>(sourceImage.width());
-    const double sourceScaleFactorY = scaledSource.second->height() / static_cast<double>(sourceImage.height());
+    const double sourceScaleFactorX = scaledSource.second->width() / static_cast<double>(sourceSize.width());
+    const double sourceScaleFactorY = scaledSource.second->height() / static_cast<double>(sourceSize.height());
 
     const qreal sourceX = (sourcePoint.x() - croppedSourceRect.x() / sourceScaleFactorX) * destinationRect.width() / croppedSourceRect.width() * sourceScaleFactorX + destinationRect.x();
     const qreal sourceY = (sourcePoint.y() - croppedSourceRect.y() / sourceScaleFactorY) * destinationRect.height() / croppedSourceRect.height() * sourceScaleFactorY + destinationRect.y();
@@ -530,6 +1784,245 @@ QPointF QResultImageView::sourceToScreenActual(const QPointF& sourcePoint) const
     return QPointF(sourceX, sourceY);
 }
 
+QTransform QResultImageView::getSourceToScreenTransform() const
+{
+    // the same mapping as in sourceToScreenActual, but for many points at a time
+    const double scaleFactor = getScaleFactor();
+
+    if (isnan(scaleFactor) || croppedSourceRect.isEmpty()) {
+        return QTransform();
+    }
+
+    const std::pair<double, const QPixmap*> scaledSource = getSourcePixmap(scaleFactor);
+
+    const double sourceScaleFactorX = scaledSource.second->width() / static_cast<double>(sourceSize.width());
+    const double sourceScaleFactorY = scaledSource.second->height() / static_cast<double>(sourceSize.height());
+
+    const double m11 = destinationRect.width() / static_cast<double>(croppedSourceRect.width()) * sourceScaleFactorX;
+    const double m22 = destinationRect.height() / static_cast<double>(croppedSourceRect.height()) * sourceScaleFactorY;
+    const double dx = destinationRect.x() - croppedSourceRect.x() / sourceScaleFactorX * m11;
+    const double dy = destinationRect.y() - croppedSourceRect.y() / sourceScaleFactorY * m22;
+
+    return QTransform(m11, 0, 0, m22, dx, dy);
+}
+
+QResultImageView::OffscreenRenderer QResultImageView::createOffscreenRenderer() const
+{
+    OffscreenRenderer renderer;
+    renderer.sourceImage = sourceImage;
+    renderer.sourceSize = sourceSize;
+    renderer.sourceImagePyramid = sourceImagePyramid;
+    renderer.results = results;
+    renderer.resultBoundingRects = resultBoundingRects;
+    renderer.resultDrawOrder = resultDrawOrder;
+    renderer.resultVisibility = resultVisibility;
+    renderer.maxPenWidth = getMaxPenWidth(resultPens);
+    renderer.resultLabelsVisible = resultLabelsVisible;
+    renderer.labelFont = font();
+    renderer.resultsVisible = resultsVisible;
+    renderer.pixelSize_m = pixelSize_m;
+    return renderer;
+}
+
+QImage QResultImageView::renderToImage(const QRectF& sourceRect, const QSize& outputSize) const
+{
+    return createOffscreenRenderer().render(sourceRect, outputSize);
+}
+
+QImage QResultImageView::OffscreenRenderer::render(const QRectF& sourceRect, const QSize& outputSize) const
+{
+    QImage output(outputSize, QImage::Format_RGB32);
+    renderBand(output, 0, sourceRect, outputSize, placeLabels(sourceRect, outputSize));
+    return output;
+}
+
+bool QResultImageView::OffscreenRenderer::render(const QRectF& sourceRect, const QSize& outputSize, int bandHeight, const std::function<bool(const QImage&, int)>& writeBand) const
+{
+    if (bandHeight <= 0) {
+        return false;
+    }
+
+    // Placed for the whole output at once, so that labels near band boundaries are consistent
+    const std::vector<PlacedLabel> placedLabels = placeLabels(sourceRect, outputSize);
+
+    for (int y = 0; y < outputSize.height(); y += bandHeight) {
+        QImage band(outputSize.width(), std::min(bandHeight, outputSize.height() - y), QImage::Format_RGB32);
+        renderBand(band, y, sourceRect, outputSize, placedLabels);
+        if (!writeBand(band, y)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+std::vector<QResultImageView::PlacedLabel> QResultImageView::OffscreenRenderer::placeLabels(const QRectF& sourceRect, const QSize& outputSize) const
+{
+    if (!resultsVisible || !resultLabelsVisible || sourceRect.isEmpty() || outputSize.isEmpty()) {
+        return std::vector<PlacedLabel>();
+    }
+
+    const QFontMetricsF fontMetrics(labelFont);
+    const auto getLabelSize = [this, &fontMetrics](size_t i) {
+        return fontMetrics.boundingRect((*results)[i].label).size();
+    };
+
+    return placeResultLabels(*results, resultBoundingRects, resultDrawOrder, resultVisibility, sourceRect, outputSize.width() / sourceRect.width(), outputSize.height() / sourceRect.height(), outputSize, getLabelSize);
+}
+
+void QResultImageView::OffscreenRenderer::renderBand(QImage& band, int bandTop, const QRectF& sourceRect, const QSize& outputSize, const std::vector<PlacedLabel>& placedLabels) const
+{
+    band.fill(Qt::black);
+
+    if (sourceSize.isEmpty() || sourceRect.isEmpty() || outputSize.isEmpty()) {
+        return;
+    }
+
+    // output pixels per source pixel
+    const double scaleX = outputSize.width() / sourceRect.width();
+    const double scaleY = outputSize.height() / sourceRect.height();
+
+    // The part of the source image that this band covers
+    const QRectF bandSourceRect(sourceRect.left(), sourceRect.top() + bandTop / scaleY, sourceRect.width(), band.height() / scaleY);
+
+    QPainter painter(&band);
+
+    const std::pair<double, const QImage*> level = getPyramidLevel(sourceImage, sourceImagePyramid, std::min(1.0, std::max(scaleX, scaleY)));
+    const QImage& levelImage = *level.second;
+
+    // these two should be approximately equal
+    const double levelScaleX = levelImage.width() / static_cast<double>(sourceSize.width());
+    const double levelScaleY = levelImage.height() / static_cast<double>(sourceSize.height());
+
+    painter.translate(0, -bandTop);
+    painter.scale(scaleX / levelScaleX, scaleY / levelScaleY);
+    painter.translate(-sourceRect.left() * levelScaleX, -sourceRect.top() * levelScaleY);
+
+    if (scaleX < levelScaleX || scaleY < levelScaleY) {
+        painter.setRenderHint(QPainter::SmoothPixmapTransform);
+    }
+
+    // A margin of a pixel makes the bands line up seamlessly even when interpolating
+    const QRect levelBandRect = QRectF(
+        bandSourceRect.left() * levelScaleX,
+        bandSourceRect.top() * levelScaleY,
+        bandSourceRect.width() * levelScaleX,
+        bandSourceRect.height() * levelScaleY
+    ).toAlignedRect().adjusted(-1, -1, 1, 1).intersected(levelImage.rect());
+
+    if (!levelBandRect.isEmpty()) {
+        painter.drawImage(levelBandRect.topLeft(), levelImage, levelBandRect);
+    }
+
+    painter.resetTransform();
+    painter.setRenderHint(QPainter::SmoothPixmapTransform, false);
+    painter.translate(0, -bandTop);
+
+    if (resultsVisible) {
+        // Strokes of results just outside the band may still reach into it
+        const double penMargin = maxPenWidth / 2 + 1; // in output pixels
+        const QRectF cullingRect = bandSourceRect.adjusted(-penMargin / scaleX, -penMargin / scaleY, penMargin / scaleX, penMargin / scaleY);
+
+        for (size_t i = 0, end = results->size(); i < end; ++i) {
+            if (resultVisibility[i] && overlaps(resultBoundingRects[i], cullingRect)) {
+                drawResultToViewport(painter, (*results)[i], sourceRect.topLeft(), scaleX, scaleY);
+            }
+        }
+
+        const QFontMetricsF fontMetrics(labelFont);
+        painter.setFont(labelFont);
+        for (const PlacedLabel& placedLabel : placedLabels) {
+            const QRectF labelRect(placedLabel.position, fontMetrics.boundingRect((*results)[placedLabel.resultIndex].label).size());
+            if (labelRect.bottom() >= bandTop && labelRect.top() < bandTop + band.height()) {
+                painter.setPen((*results)[placedLabel.resultIndex].pen.color());
+                painter.drawText(labelRect, Qt::AlignLeft | Qt::AlignTop, (*results)[placedLabel.resultIndex].label);
+            }
+        }
+    }
+
+    if (!isnan(pixelSize_m)) {
+        drawYardstick(painter, outputSize, 1.0 / scaleX, 1.0 / scaleY, pixelSize_m);
+    }
+}
+
+bool QResultImageView::OffscreenRenderer::renderToTiffFile(const QString& fileName, const QRectF& sourceRect, const QSize& outputSize, int bandHeight) const
+{
+    if (outputSize.isEmpty() || bandHeight <= 0) {
+        return false;
+    }
+
+    // Uncompressed RGB, one strip per band: everything in the header is known before rendering starts
+    const quint32 entryCount = 10;
+    const quint32 stripCount = (outputSize.height() + bandHeight - 1) / bandHeight;
+    const quint64 rowByteCount = 3 * static_cast<quint64>(outputSize.width());
+
+    const quint32 ifdOffset = 8;
+    const quint32 bitsPerSampleOffset = ifdOffset + 2 + entryCount * 12 + 4;
+    const quint32 stripOffsetsOffset = bitsPerSampleOffset + 3 * 2;
+    const quint32 stripByteCountsOffset = stripOffsetsOffset + 4 * stripCount;
+    const quint32 imageDataOffset = stripByteCountsOffset + 4 * stripCount;
+
+    // Classic TIFF uses 32-bit offsets
+    if (imageDataOffset + rowByteCount * outputSize.height() > std::numeric_limits<quint32>::max()) {
+        return false;
+    }
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setByteOrder(QDataStream::LittleEndian);
+
+    const auto writeShortEntry = [&stream](quint16 tag, quint16 value) {
+        stream << tag << quint16(3) << quint32(1) << value << quint16(0);
+    };
+    const auto writeLongEntry = [&stream](quint16 tag, quint32 count, quint32 valueOrOffset) {
+        stream << tag << quint16(4) << count << valueOrOffset;
+    };
+    const auto getStripByteCount = [&](quint32 strip) {
+        return static_cast<quint32>(std::min(bandHeight, outputSize.height() - static_cast<int>(strip) * bandHeight) * rowByteCount);
+    };
+
+    stream.writeRawData("II", 2);
+    stream << quint16(42) << ifdOffset;
+
+    stream << quint16(entryCount);
+    writeLongEntry(256, 1, outputSize.width()); // ImageWidth
+    writeLongEntry(257, 1, outputSize.height()); // ImageLength
+    stream << quint16(258) << quint16(3) << quint32(3) << bitsPerSampleOffset; // BitsPerSample
+    writeShortEntry(259, 1); // Compression: none
+    writeShortEntry(262, 2); // PhotometricInterpretation: RGB
+    writeLongEntry(273, stripCount, stripCount == 1 ? imageDataOffset : stripOffsetsOffset); // StripOffsets
+    writeShortEntry(277, 3); // SamplesPerPixel
+    writeLongEntry(278, 1, bandHeight); // RowsPerStrip
+    writeLongEntry(279, stripCount, stripCount == 1 ? getStripByteCount(0) : stripByteCountsOffset); // StripByteCounts
+    writeShortEntry(284, 1); // PlanarConfiguration: chunky
+    stream << quint32(0); // no more IFDs
+
+    stream << quint16(8) << quint16(8) << quint16(8);
+
+    for (quint32 strip = 0; strip < stripCount; ++strip) {
+        stream << static_cast<quint32>(imageDataOffset + strip * bandHeight * rowByteCount);
+    }
+    for (quint32 strip = 0; strip < stripCount; ++strip) {
+        stream << getStripByteCount(strip);
+    }
+
+    const bool rendered = render(sourceRect, outputSize, bandHeight, [&stream, rowByteCount](const QImage& band, int) {
+        const QImage rgb = band.convertToFormat(QImage::Format_RGB888);
+        for (int y = 0, end = rgb.height(); y < end; ++y) {
+            if (stream.writeRawData(reinterpret_cast<const char*>(rgb.constScanLine(y)), static_cast<int>(rowByteCount)) != static_cast<int>(rowByteCount)) {
+                return false;
+            }
+        }
+        return true;
+    });
+
+    return rendered && stream.status() == QDataStream::Ok;
+}
+
 void QResultImageView::performSmoothTransformation()
 {
     --smoothTransformationPendingCounter;
@@ -541,7 +2034,8 @@ void QResultImageView::performSmoothTransformation()
 
 Qt::TransformationMode QResultImageView::getInitialTransformationMode() const
 {
-    const double imageScaler = getImageScaler();
+    // source pixels per physical screen pixel
+    const double imageScaler = getImageScaler() / getDevicePixelRatio();
 
     if (imageScaler > 1.0 && transformationMode == SmoothTransformationWhenZoomedOut) {
         return Qt::SmoothTransformation;
@@ -553,7 +2047,8 @@ Qt::TransformationMode QResultImageView::getInitialTransformationMode() const
 
 Qt::TransformationMode QResultImageView::getEventualTransformationMode() const
 {
-    const double imageScaler = getImageScaler();
+    // source pixels per physical screen pixel
+    const double imageScaler = getImageScaler() / getDevicePixelRatio();
 
     if (imageScaler > 1.0 && transformationMode != AlwaysFastTransformation) {
         return Qt::SmoothTransformation;
@@ -574,11 +2069,15 @@ void QResultImageView::considerActivatingSmoothTransformationTimer()
 void QResultImageView::setResultsVisible(bool visible)
 {
     if (resultsVisible != visible) {
+        if (isResultHighlighted()) {
+            update(getResultHighlightRect());
+        }
+
         resultsVisible = visible;
 
-        if (!results.empty()) {
+        if (!results->empty()) {
             drawResultsToViewport();
-            update();
+            update(destinationRect);
         }
     }
 }
@@ -603,19 +2102,17 @@ void QResultImageView::setPixelSizeInMeters(double pixelSizeInMeters)
     update();
 }
 
-void QResultImageView::drawYardstick(QPainter& painter)
+void QResultImageView::drawYardstick(QPainter& painter, const QSize& area, double imageScalerX, double imageScalerY, double pixelSize_m)
 {
-    const double imageScaler = getImageScaler();
-
-    if (isnan(imageScaler)) {
+    if (isnan(imageScalerX) || isnan(imageScalerY)) {
         return;
     }
 
-    const QRect r = rect();
+    const QRect r(QPoint(0, 0), area);
 
     const int margin = 20;
 
-    const auto getYardstickSize_m = [&](int rectDimension) {
+    const auto getYardstickSize_m = [&](int rectDimension, double imageScaler) {
         const double maxYardstickSize_m = (rectDimension - 2 * margin) * pixelSize_m * imageScaler;
 
         // round down to the nearest power of 10
@@ -658,10 +2155,10 @@ void QResultImageView::drawYardstick(QPainter& painter)
     };
 
     if (r.width() > 8 * margin && r.height() > 2 * margin) {
-        const double yardstickSizeX_m = getYardstickSize_m(r.width());
+        const double yardstickSizeX_m = getYardstickSize_m(r.width(), imageScalerX);
 
         const int y = r.height() - margin;
-        const int w = std::round(yardstickSizeX_m / pixelSize_m / imageScaler);
+        const int w = std::round(yardstickSizeX_m / pixelSize_m / imageScalerX);
 
         painter.setPen(Qt::white);
         painter.drawLine(margin, y - 1, margin + w, y - 1);
@@ -673,10 +2170,10 @@ void QResultImageView::drawYardstick(QPainter& painter)
     }
 
     if (r.height() > 8 * margin && r.width() > 2 * margin) {
-        const double yardstickSizeY_m = getYardstickSize_m(r.height());
+        const double yardstickSizeY_m = getYardstickSize_m(r.height(), imageScalerY);
 
         const int origin = r.height() - margin;
-        const int h = std::round(yardstickSizeY_m / pixelSize_m / imageScaler);
+        const int h = std::round(yardstickSizeY_m / pixelSize_m / imageScalerY);
 
         painter.setPen(Qt::white);
         painter.drawLine(margin + 1, origin - h, margin + 1, origin - 1);
@@ -721,34 +2218,107 @@ int QResultImageView::getZoomLevel() const
     return zoomLevel;
 }
 
-void QResultImageView::setResultPolygons()
+void QResultImageView::setResultGeometry()
 {
-    // set result polygons to be used for the mouse-on-result test
-    resultPolygons.resize(results.size());
-    for (size_t i = 0, end = results.size(); i < end; ++i) {
-        QPolygonF& resultPolygon = resultPolygons[i];
-        const Result& result = results[i];
-        resultPolygon.resize(static_cast<int>(result.contour.size()));
-        for (size_t j = 0, end = result.contour.size(); j < end; ++j) {
-            resultPolygon[static_cast<int>(j)] = result.contour[j];
+    // the bounding rects are used for culling, and for the mouse-on-result test; the contours themselves are not copied
+    resultBoundingRects.resize(results->size());
+    for (size_t i = 0, end = results->size(); i < end; ++i) {
+        const std::vector<QPointF>& contour = (*results)[i].contour;
+        if (contour.empty()) {
+            resultBoundingRects[i] = QRectF();
+            continue;
+        }
+        const auto x = std::minmax_element(contour.begin(), contour.end(), [](const QPointF& a, const QPointF& b) { return a.x() < b.x(); });
+        const auto y = std::minmax_element(contour.begin(), contour.end(), [](const QPointF& a, const QPointF& b) { return a.y() < b.y(); });
+        resultBoundingRects[i] = QRectF(QPointF(x.first->x(), y.first->y()), QPointF(x.second->x(), y.second->y()));
+    }
+
+    // label layouts are created when first drawn
+    resultLabelTexts.assign(results->size(), QStaticText());
+
+    // results typically share a handful of pens, and consecutive results often the very same one; but there may
+    // also be a distinct color per result, so the pens are looked up by their most distinctive properties first
+    typedef std::tuple<qreal, int, QRgb, int, int> PenKey;
+    std::map<PenKey, std::vector<size_t>> penIndicesByKey;
+
+    resultPens.clear();
+    resultPenIndices.resize(results->size());
+    for (size_t i = 0, end = results->size(); i < end; ++i) {
+        const QPen& pen = (*results)[i].pen;
+        if (i > 0 && resultPens[resultPenIndices[i - 1]] == pen) {
+            resultPenIndices[i] = resultPenIndices[i - 1];
+            continue;
+        }
+
+        std::vector<size_t>& candidates = penIndicesByKey[PenKey(pen.widthF(), pen.style(), pen.color().rgba(), pen.capStyle(), pen.joinStyle())];
+        const auto j = std::find_if(candidates.begin(), candidates.end(), [this, &pen](size_t penIndex) {
+            return resultPens[penIndex] == pen;
+        });
+
+        if (j != candidates.end()) {
+            resultPenIndices[i] = *j;
+        }
+        else {
+            resultPenIndices[i] = resultPens.size();
+            candidates.push_back(resultPens.size());
+            resultPens.push_back(pen);
         }
     }
+
+    scaledResultPolygons.clear();
+    scaledResultPaths.clear();
+
+    // when rendering progressively, the largest results are drawn first
+    resultDrawOrder.resize(results->size());
+    std::iota(resultDrawOrder.begin(), resultDrawOrder.end(), 0);
+    std::stable_sort(resultDrawOrder.begin(), resultDrawOrder.end(), [this](size_t i, size_t j) {
+        const QRectF& a = resultBoundingRects[i];
+        const QRectF& b = resultBoundingRects[j];
+        return a.width() * a.height() > b.width() * b.height();
+    });
+
+    updateResultVisibility();
+}
+
+void QResultImageView::updateResultVisibility()
+{
+    std::vector<bool> newResultVisibility(results->size());
+    for (size_t i = 0, end = results->size(); i < end; ++i) {
+        const Result& result = (*results)[i];
+        const bool categoryVisible = result.category >= 64 || (resultCategoryMask & (quint64(1) << result.category)) != 0;
+        newResultVisibility[i] = categoryVisible && result.score >= resultMinimumScore;
+    }
+
+    if (newResultVisibility != resultVisibility) {
+        resultVisibility = std::move(newResultVisibility);
+
+        // hidden results are left out of the paths
+        scaledResultPaths.clear();
+    }
 }
 
 void QResultImageView::updateSourcePyramid()
 {
-    sourceImagePyramid.clear();
+    sourceImagePyramid = buildSourcePyramid(sourceImage, getPyramidTransformationMode());
     sourcePixmapPyramid.clear();
+}
 
-    const Qt::TransformationMode mode = transformationMode == AlwaysFastTransformation
+Qt::TransformationMode QResultImageView::getPyramidTransformationMode() const
+{
+    return transformationMode == AlwaysFastTransformation
             ? Qt::FastTransformation
             : Qt::SmoothTransformation;
+}
+
+std::map<double, QImage> QResultImageView::buildSourcePyramid(const QImage& image, Qt::TransformationMode mode)
+{
+    std::map<double, QImage> pyramid;
 
     double scaleFactor = 1.0;
-    double width = sourceImage.width();
-    double height = sourceImage.height();
+    double width = image.width();
+    double height = image.height();
 
-    const QImage* previous = &sourceImage;
+    const QImage* previous = &image;
     const double step = 2.0;
 
     while (width > 50 && height > 50) {
@@ -756,12 +2326,16 @@ void QResultImageView::updateSourcePyramid()
         width /= step;
         height /= step;
 
-        sourceImagePyramid[scaleFactor] = previous->scaled(QSize(std::round(width), std::round(height)), Qt::IgnoreAspectRatio, mode);
+        QImage& level = pyramid[scaleFactor];
+        level = previous->scaled(QSize(std::round(width), std::round(height)), Qt::IgnoreAspectRatio, mode);
 
-        previous = &sourceImagePyramid.rbegin()->second;
+        // each level is computed from the previous (next larger) one
+        previous = &level;
     }
 
-    if (sourceImagePyramid.empty()) {
-        sourceImagePyramid[1.0] = sourceImage;
+    if (pyramid.empty()) {
+        pyramid[1.0] = image;
     }
+
+    return pyramid;
 }
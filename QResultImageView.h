@@ -2,7 +2,19 @@
 #define QRESULTIMAGEVIEW_H
 
 #include <QWidget>
+#include <QPointer>
+#include <qpainterpath.h>
 #include <qpen.h>
+#include <qstatictext.h>
+#include <qtimer.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+
+class QScreen;
+class QWindow;
 
 class QResultImageView : public QWidget
 {
@@ -14,19 +26,94 @@ public:
     void setImage(const QImage& image);
 
     void setImagePyramid(const std::vector<QImage>& imagePyramid);
+    void setImagePyramid(std::vector<QImage>&& imagePyramid);
 
     struct Result {
         QPen pen;
         std::vector<QPointF> contour;
+        QString label; // optional; drawn next to the result, in the color of the pen
+        unsigned int category = 0; // for filtering; see setResultFilter
+        double score = 1.0; // for filtering; see setResultFilter
     };
 
     typedef std::vector<Result> Results;
 
-    void setResults(const Results& results);
+    // The results are kept as they are, and never modified. Pass them as an rvalue (std::move), or use the
+    // shared variants, in order to avoid copying them. A null pointer means no results.
+    void setResults(Results results);
+    void setSharedResults(std::shared_ptr<const Results> results);
+
+    void setImageAndResults(const QImage& image, Results results);
+    void setImageAndSharedResults(const QImage& image, std::shared_ptr<const Results> results);
+
+    void setImagePyramidAndResults(std::vector<QImage> imagePyramid, Results results);
+    void setImagePyramidAndSharedResults(std::vector<QImage> imagePyramid, std::shared_ptr<const Results> results);
+
+    // Decodes the file on a worker thread. If the file format allows reading a reduced-resolution
+    // version cheaply, it is shown first; the full resolution follows once available. A newer call
+    // (or setting the image in any other way) cancels a load still in progress.
+    void setImageFile(const QString& path);
+
+    // Keeps up to maxFrameCount of the most recent frames - as set using setImageAndResults or
+    // setImagePyramidAndResults - along with their pyramids, pixmaps and results, so that they can be
+    // shown again without any recomputation. The oldest frames are evicted first, also when the total
+    // size would exceed maxByteCount. A maxFrameCount of 0 (the default) disables the history.
+    void setFrameHistoryLimits(size_t maxFrameCount, size_t maxByteCount);
+    size_t getFrameHistorySize() const;
+
+    // How many frames back from the most recent one is displayed; 0 means the most recent one.
+    size_t getFrameHistoryPosition() const;
+
+    // Return false if there is no such frame in the history.
+    bool seekFrameHistory(size_t framesBack);
+    bool stepFrameHistory(int steps); // negative steps go back in time
+
+private:
+    struct PlacedLabel {
+        size_t resultIndex;
+        QPointF position; // top-left corner
+    };
+
+public:
+    // A snapshot of the image, the results and the yardstick setting, for rendering offscreen.
+    // Cheap to create, as the image data is implicitly shared; can be used from worker threads.
+    class OffscreenRenderer
+    {
+    public:
+        // sourceRect is in source image coordinates; it is stretched to fill outputSize.
+        QImage render(const QRectF& sourceRect, const QSize& outputSize) const;
+
+        // Renders horizontal bands of at most bandHeight rows, so that the full output never needs to
+        // be in memory at once. Stops, returning false, as soon as writeBand returns false.
+        bool render(const QRectF& sourceRect, const QSize& outputSize, int bandHeight, const std::function<bool(const QImage& band, int y)>& writeBand) const;
+
+        // Streams the output into an uncompressed TIFF file, one band at a time.
+        bool renderToTiffFile(const QString& fileName, const QRectF& sourceRect, const QSize& outputSize, int bandHeight = 256) const;
+
+    private:
+        friend class QResultImageView;
+
+        std::vector<PlacedLabel> placeLabels(const QRectF& sourceRect, const QSize& outputSize) const;
+        void renderBand(QImage& band, int bandTop, const QRectF& sourceRect, const QSize& outputSize, const std::vector<PlacedLabel>& placedLabels) const;
+
+        QImage sourceImage;
+        QSize sourceSize;
+        std::map<double, QImage> sourceImagePyramid;
+        std::shared_ptr<const Results> results = std::make_shared<const Results>();
+        std::vector<QRectF> resultBoundingRects;
+        std::vector<size_t> resultDrawOrder;
+        std::vector<bool> resultVisibility;
+        double maxPenWidth = 1.0; // for culling
+        bool resultsVisible = true;
+        bool resultLabelsVisible = true;
+        QFont labelFont;
+        double pixelSize_m = std::numeric_limits<double>::quiet_NaN();
+    };
 
-    void setImageAndResults(const QImage& image, const Results& results);
+    OffscreenRenderer createOffscreenRenderer() const;
 
-    void setImagePyramidAndResults(const std::vector<QImage>& imagePyramid, const Results& results);
+    // Renders on the calling thread; see OffscreenRenderer for rendering on worker threads.
+    QImage renderToImage(const QRectF& sourceRect, const QSize& outputSize) const;
 
     enum TransformationMode {
         AlwaysFastTransformation, // most responsive, but may not look great on some images
@@ -38,6 +125,40 @@ public:
 
     void setResultsVisible(bool visible);
 
+    // Shows only the results whose category bit is set in categoryMask (categories 64 and above are
+    // never filtered out), and whose score is at least minimumScore. Cheap enough to be driven by a slider:
+    // the results are not resubmitted. Hidden results are not hit-tested either.
+    void setResultFilter(quint64 categoryMask, double minimumScore);
+
+    // Labels that would overlap labels of larger results are left out.
+    void setResultLabelsVisible(bool visible);
+
+    // When enabled, results are drawn in time-sliced chunks, largest first, so that huge result sets
+    // do not block the event loop; the overlay then fills in during the following event loop iterations.
+    void setProgressiveResultRendering(bool enabled, int sliceBudgetMilliseconds = 4);
+
+    // Outline drawn over the result under the mouse cursor. Qt::NoPen (the default) means no highlighting.
+    void setResultHighlightPen(const QPen& pen);
+
+    enum ComparisonMode {
+        NoComparison,
+        SplitComparison, // the comparison image is shown to the right of a movable split line
+        BlendComparison,
+        DifferenceComparison // the absolute difference, per channel
+    };
+
+    // A second image of the same size as the source image (e.g., a golden image), shown with the same zoom,
+    // pan and results. Only the visible part is composed, once per redraw. The comparison is inactive while
+    // the sizes differ, or if the image is null.
+    void setComparisonImage(const QImage& image);
+    void setComparisonMode(ComparisonMode mode);
+
+    // In widget coordinates: 0 is the left edge, and 1 the right edge. The user can also drag the line.
+    void setComparisonSplitPosition(double position);
+
+    // How much of the comparison image is blended in: 0 shows only the source, and 1 only the comparison image.
+    void setComparisonBlendWeight(double weight);
+
     void resetZoomAndPan();
 
     // Has the user panned the view, or zoomed in or out? False if not.
@@ -62,9 +183,16 @@ signals:
     void mouseNotOnResult();
     void mouseAtCoordinates(QPointF sourcePoint, int pixelIndex); // pixelIndex is -1 if it's not valid
     void mouseLeft();
+    void imageFileLoaded(QString path);
+    void imageFileLoadFailed(QString path, QString errorString);
+    void comparisonSplitMoved(double position);
 
 protected:
+    bool event(QEvent* event) override;
+    void showEvent(QShowEvent* event) override;
     void paintEvent(QPaintEvent* event) override;
+    void mousePressEvent(QMouseEvent* event) override;
+    void mouseReleaseEvent(QMouseEvent* event) override;
     void mouseMoveEvent(QMouseEvent *event) override;
     void leaveEvent(QEvent* event) override;
     void wheelEvent(QWheelEvent* event) override;
@@ -79,15 +207,54 @@ protected:
 
 private slots:
     void performSmoothTransformation();
+    void continueProgressiveResultRendering();
+    void watchScreen(QScreen* screen);
+    void checkDevicePixelRatio();
 
 private:
     void redrawEverything(Qt::TransformationMode transformationMode);
 
     void updateViewport(Qt::TransformationMode transformationMode);
     void drawResultsToViewport();
+    static void drawResultToViewport(QPainter& painter, const Result& result, const QPointF& sourceTopLeft, double scaleFactorX, double scaleFactorY);
+
+    // The part of the source image currently in the viewport, in source image coordinates.
+    QRectF getViewportSourceRect() const;
+
+    // The contours scaled to the viewport and rounded, but not yet translated; so they stay valid when panning.
+    void setScaledResultCacheScaleFactor(double scaleFactor);
+    void prepareScaledResultPolygons(double scaleFactor);
+    const QPolygon& getScaledResultPolygon(size_t resultIndex);
+    struct ScaledResultPath {
+        size_t penIndex;
+        QRectF sourceBoundingRect; // for culling
+        QPainterPath path;
+    };
+
+    void prepareScaledResultPaths(double scaleFactor);
+
+    // The viewport source rect, extended by the widest pen.
+    QRectF getResultCullingRect(double scaleFactor) const;
+    static double getMaxPenWidth(const std::vector<QPen>& pens);
+
+    static bool overlaps(const QRectF& a, const QRectF& b);
 
+    // In screen space, on top of the viewport pixmap; like the highlight and the yardstick.
+    void drawResultLabels(QPainter& painter, const QRect& exposedRect);
+
+    static std::vector<PlacedLabel> placeResultLabels(const Results& results, const std::vector<QRectF>& resultBoundingRects, const std::vector<size_t>& resultDrawOrder, const std::vector<bool>& resultVisibility, const QRectF& sourceRect, double scaleFactorX, double scaleFactorY, const QSize& outputSize, const std::function<QSizeF(size_t)>& getLabelSize);
+
+    // Physical screen pixels per source pixel, at most 1 (when zoomed in further, paintEvent does the rest).
     double getScaleFactor() const;
 
+    double getDevicePixelRatio() const;
+
+    // Keeps track of the window and its screen, so that a change of the device pixel ratio gets noticed.
+    void watchWindow();
+
+    // Result pens are specified in device-independent pixels, like everything else in Qt.
+    static QPen getDevicePen(const QPen& pen, double devicePixelRatio);
+
     double getSourceImageVisibleWidth() const;
     double getSourceImageVisibleHeigth() const;
 
@@ -102,7 +269,8 @@ private:
 
     void limitOffset();
 
-    void drawYardstick(QPainter& painter);
+    // imageScalerX and imageScalerY are source pixels per output pixel; they differ if the output is stretched.
+    static void drawYardstick(QPainter& painter, const QSize& area, double imageScalerX, double imageScalerY, double pixelSize_m);
 
     Qt::TransformationMode getInitialTransformationMode() const;
     Qt::TransformationMode getEventualTransformationMode() const;
@@ -118,13 +286,85 @@ private:
     void checkMousePan(const QMouseEvent* event);
     void checkMouseOnResult(const QMouseEvent* event);
 
-    void setResultPolygons();
+    void setSourceImagePyramid(std::vector<QImage>&& imagePyramid);
+    void setResultData(std::shared_ptr<const Results> newResults);
+
+    void setResultGeometry();
+    void updateResultVisibility();
+
+    // Using the odd-even rule, like QPolygonF::containsPoint with Qt::OddEvenFill.
+    static bool containsPoint(const std::vector<QPointF>& contour, const QPointF& point);
+
+    // When the results are replaced; the next mouse move finds the result under the cursor again.
+    void resetMouseOnResult();
+
+    bool isResultHighlighted() const;
+    QRect getResultHighlightRect() const;
+    void drawResultHighlight(QPainter& painter) const;
+
+    QTransform getSourceToScreenTransform() const;
+
+    bool isComparisonActive() const;
+    int getComparisonSplitX() const;
+    bool isOnComparisonSplit(int x) const;
+
+    // The crop of the source pyramid level for scaleFactor, composed with the same crop of the comparison image.
+    QImage getComparisonCrop(double scaleFactor, const QRect& rect) const;
 
     void updateSourcePyramid();
 
+    Qt::TransformationMode getPyramidTransformationMode() const;
+
+    static std::map<double, QImage> buildSourcePyramid(const QImage& image, Qt::TransformationMode mode);
+
+    struct LoadedImageFile {
+        QImage image;
+        QSize fullSize;
+        std::map<double, QImage> pyramid;
+        Qt::TransformationMode pyramidTransformationMode = Qt::FastTransformation;
+        QString errorString;
+    };
+
+    static LoadedImageFile readImageFilePreview(const QString& path, int maxPreviewDimension, const std::function<bool()>& isCancelled);
+    static LoadedImageFile readImageFile(const QString& path, Qt::TransformationMode pyramidTransformationMode, const std::function<bool()>& isCancelled);
+
+    void showImageFilePreview(const LoadedImageFile& preview);
+    void showLoadedImageFile(LoadedImageFile& loaded);
+
+    void cancelImageFileLoading();
+
+    struct Frame {
+        QImage sourceImage;
+        QSize sourceSize;
+        QPixmap sourcePixmap;
+        std::map<double, QImage> sourceImagePyramid;
+        std::map<double, QPixmap> sourcePixmapPyramid;
+        std::shared_ptr<const Results> results;
+        std::vector<QRectF> resultBoundingRects;
+        std::vector<size_t> resultDrawOrder;
+        std::vector<QStaticText> resultLabelTexts;
+        std::vector<QPen> resultPens;
+        std::vector<size_t> resultPenIndices;
+        std::vector<bool> resultVisibility;
+        double scaledResultCacheScaleFactor = std::numeric_limits<double>::quiet_NaN();
+        std::vector<QPolygon> scaledResultPolygons;
+        std::vector<ScaledResultPath> scaledResultPaths;
+        size_t byteCount = 0;
+    };
+
+    void beginNewFrame();
+    void storeCurrentFrame();
+    void restoreFrame(size_t index);
+    void limitFrameHistory();
+    size_t getCurrentFrameByteCount() const;
+
     std::pair<double, const QPixmap*> getSourcePixmap(double scaleFactor) const;
 
-    QImage sourceImage;
+    // The coarsest level that still has at least the requested resolution (or else the finest level there is).
+    static std::pair<double, const QImage*> getPyramidLevel(const QImage& image, const std::map<double, QImage>& pyramid, double scaleFactor);
+
+    QImage sourceImage; // may be null while only a preview of an image file has been loaded
+    QSize sourceSize;
     mutable QPixmap sourcePixmap;
     std::map<double, QImage> sourceImagePyramid;
     mutable std::map<double, QPixmap> sourcePixmapPyramid;
@@ -136,7 +376,20 @@ private:
     QRect croppedSourceRect;
     QRect destinationRect;
 
-    std::vector<QPolygonF> resultPolygons;
+    std::vector<QRectF> resultBoundingRects;
+    std::vector<size_t> resultDrawOrder;
+    std::vector<QStaticText> resultLabelTexts;
+    QFont resultLabelFont;
+    std::vector<PlacedLabel> placedResultLabels; // relative to destinationRect
+    bool placedResultLabelsValid = false;
+    std::vector<bool> resultVisibility; // according to the result filter
+
+    std::vector<QPen> resultPens; // the distinct pens
+    std::vector<size_t> resultPenIndices; // for each result, an index to resultPens
+
+    double scaledResultCacheScaleFactor = std::numeric_limits<double>::quiet_NaN();
+    std::vector<QPolygon> scaledResultPolygons; // for each result; scaled when first needed
+    std::vector<ScaledResultPath> scaledResultPaths; // per pen and tile; only the visible results
 
     int zoomLevel = 0;
     bool zoomEnabled = true;
@@ -149,14 +402,47 @@ private:
 
     size_t mouseOnResultIndex = -1;
 
-    Results results;
+    QPen resultHighlightPen = Qt::NoPen;
+
+    std::shared_ptr<const Results> results = std::make_shared<const Results>(); // never null
 
     TransformationMode transformationMode = DelayedSmoothTransformationWhenZoomedOut;
     int smoothTransformationPendingCounter = 0;
 
     bool resultsVisible = true;
+    bool resultLabelsVisible = true;
+
+    quint64 resultCategoryMask = ~quint64(0);
+    double resultMinimumScore = -std::numeric_limits<double>::infinity();
+
+    bool progressiveResultRendering = false;
+    int progressiveResultRenderingSliceBudget_ms = 4;
+    size_t progressiveResultRenderingPosition = 0;
+    QTimer progressiveResultRenderingTimer;
 
     double pixelSize_m = std::numeric_limits<double>::quiet_NaN();
+
+    QImage comparisonImage;
+    std::map<double, QImage> comparisonImagePyramid;
+    ComparisonMode comparisonMode = NoComparison;
+    double comparisonSplitPosition = 0.5;
+    double comparisonBlendWeight = 0.5;
+    bool comparisonSplitDragged = false;
+    bool comparisonSplitCursorSet = false;
+    bool hadPreviousCursor = false;
+    QCursor previousCursor; // to be restored when leaving the split line
+
+    QPointer<QWindow> watchedWindow;
+    QPointer<QScreen> watchedScreen;
+
+    // Shared with the worker threads, so that they can tell when their result is no longer wanted
+    std::shared_ptr<std::atomic<unsigned int>> imageFileGeneration = std::make_shared<std::atomic<unsigned int>>(0);
+    unsigned int imageFileGenerationLoaded = 0;
+
+    std::deque<Frame> frameHistory;
+    size_t frameHistoryIndex = 0; // the slot of the displayed frame is empty; its data is in the members above
+    size_t maxFrameHistoryCount = 0;
+    size_t maxFrameHistoryBytes = 0;
 };
 
 #endif // QRESULTIMAGEVIEW_H
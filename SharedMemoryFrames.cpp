@@ -0,0 +1,337 @@
+#include "SharedMemoryFrames.h"
+#include <QFile>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace SharedMemoryFrames {
+
+    size_t getAlignedSlotDataCapacity(quint32 slotDataCapacity)
+    {
+        return (static_cast<size_t>(slotDataCapacity) + dataAlignment - 1) / dataAlignment * dataAlignment;
+    }
+
+    size_t getDataOffset(quint32 slotCount)
+    {
+        const size_t headerSize = sizeof(RingHeader) + slotCount * sizeof(SlotHeader);
+        return (headerSize + dataAlignment - 1) / dataAlignment * dataAlignment;
+    }
+
+    size_t getSegmentSize(quint32 slotCount, quint32 slotDataCapacity)
+    {
+        return getDataOffset(slotCount) + slotCount * getAlignedSlotDataCapacity(slotDataCapacity);
+    }
+
+    class Mapping
+    {
+    public:
+        Mapping(void* address, size_t size)
+            : address(address), size(size)
+        {}
+
+        ~Mapping()
+        {
+            munmap(address, size);
+        }
+
+        RingHeader* getRingHeader()
+        {
+            return static_cast<RingHeader*>(address);
+        }
+
+        SlotHeader* getSlotHeader(quint32 slot)
+        {
+            return reinterpret_cast<SlotHeader*>(getRingHeader() + 1) + slot;
+        }
+
+        uchar* getSlotData(quint32 slot)
+        {
+            const RingHeader* header = getRingHeader();
+            return static_cast<uchar*>(address) + getDataOffset(header->slotCount) + slot * getAlignedSlotDataCapacity(header->slotDataCapacity);
+        }
+
+    private:
+        void* address;
+        size_t size;
+    };
+
+    // Keeps the slot reserved, and the memory mapped, for as long as a QImage refers to the slot
+    struct SlotReservation {
+        std::shared_ptr<Mapping> mapping;
+        SlotHeader* slotHeader;
+    };
+
+    void releaseSlot(void* info)
+    {
+        SlotReservation* reservation = static_cast<SlotReservation*>(info);
+        reservation->slotHeader->readerCount.fetch_sub(1);
+        delete reservation;
+    }
+
+    QByteArray getNativeName(const QString& name)
+    {
+        return QFile::encodeName(name.startsWith('/') ? name : '/' + name);
+    }
+
+    QString getSystemErrorString(const char* function)
+    {
+        return QString("%1: %2").arg(function).arg(QString::fromLocal8Bit(strerror(errno)));
+    }
+}
+
+using namespace SharedMemoryFrames;
+
+SharedMemoryFrameProducer::SharedMemoryFrameProducer(const QString& name, quint32 slotCount, quint32 maxFrameByteCount)
+    : name(name)
+{
+    if (slotCount == 0 || maxFrameByteCount == 0) {
+        errorString = "Need at least one slot of a non-zero size";
+        return;
+    }
+
+    const QByteArray nativeName = getNativeName(name);
+
+    // There may be a stale segment left by a previous run
+    shm_unlink(nativeName.constData());
+
+    const int fd = shm_open(nativeName.constData(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        errorString = getSystemErrorString("shm_open");
+        return;
+    }
+
+    const size_t size = getSegmentSize(slotCount, maxFrameByteCount);
+
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        errorString = getSystemErrorString("ftruncate");
+        close(fd);
+        shm_unlink(nativeName.constData());
+        return;
+    }
+
+    void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (address == MAP_FAILED) {
+        errorString = getSystemErrorString("mmap");
+        shm_unlink(nativeName.constData());
+        return;
+    }
+
+    // The memory is zero-filled, so the slot data is fine as is
+    RingHeader* header = new (address) RingHeader;
+    header->version = version;
+    header->slotCount = slotCount;
+    header->slotDataCapacity = maxFrameByteCount;
+    header->latestSequence.store(0);
+    header->latestSlot.store(0);
+
+    mapping = std::make_shared<Mapping>(address, size);
+
+    for (quint32 slot = 0; slot < slotCount; ++slot) {
+        SlotHeader* slotHeader = new (mapping->getSlotHeader(slot)) SlotHeader;
+        slotHeader->state.store(EmptySlot);
+        slotHeader->readerCount.store(0);
+        slotHeader->sequence.store(0);
+    }
+
+    // Consumers check this before anything else
+    header->magic.store(magic);
+}
+
+SharedMemoryFrameProducer::~SharedMemoryFrameProducer()
+{
+    if (mapping) {
+        // Consumers keep their own mappings; this just removes the name
+        shm_unlink(getNativeName(name).constData());
+    }
+}
+
+bool SharedMemoryFrameProducer::isValid() const
+{
+    return static_cast<bool>(mapping);
+}
+
+QString SharedMemoryFrameProducer::getErrorString() const
+{
+    return errorString;
+}
+
+bool SharedMemoryFrameProducer::publishFrame(const QImage& frame)
+{
+    if (!mapping) {
+        return false;
+    }
+
+    RingHeader* header = mapping->getRingHeader();
+
+    const size_t byteCount = static_cast<size_t>(frame.bytesPerLine()) * frame.height();
+    if (frame.isNull() || byteCount > header->slotDataCapacity) {
+        errorString = "The frame does not fit in a slot";
+        return false;
+    }
+
+    const quint32 latestSlot = header->latestSlot.load();
+
+    for (quint32 i = 1; i <= header->slotCount; ++i) {
+        const quint32 slot = (latestSlot + i) % header->slotCount;
+
+        // The latest frame stays available for consumers that have not got it yet
+        if (slot == latestSlot && header->slotCount > 1) {
+            continue;
+        }
+
+        SlotHeader* slotHeader = mapping->getSlotHeader(slot);
+
+        quint32 state = slotHeader->state.load();
+        if (state == WritingSlot || !slotHeader->state.compare_exchange_strong(state, WritingSlot)) {
+            continue;
+        }
+
+        // A consumer increments the reader count before checking the state, so either it sees that
+        // the slot is being written, or the reader count seen here is non-zero
+        if (slotHeader->readerCount.load() != 0) {
+            slotHeader->state.store(state);
+            continue;
+        }
+
+        memcpy(mapping->getSlotData(slot), frame.constBits(), byteCount);
+        slotHeader->width = frame.width();
+        slotHeader->height = frame.height();
+        slotHeader->bytesPerLine = frame.bytesPerLine();
+        slotHeader->format = frame.format();
+
+        const quint64 sequence = nextSequence++;
+        slotHeader->sequence.store(sequence);
+        slotHeader->state.store(ReadySlot);
+
+        // Consumers read these in the opposite order
+        header->latestSlot.store(slot);
+        header->latestSequence.store(sequence);
+
+        return true;
+    }
+
+    errorString = "Every slot is in use";
+    return false;
+}
+
+SharedMemoryFrameConsumer::SharedMemoryFrameConsumer(const QString& name)
+{
+    const int fd = shm_open(getNativeName(name).constData(), O_RDWR, 0);
+    if (fd < 0) {
+        errorString = getSystemErrorString("shm_open");
+        return;
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size < static_cast<off_t>(sizeof(RingHeader))) {
+        errorString = "Not a frame ring";
+        close(fd);
+        return;
+    }
+
+    const size_t size = static_cast<size_t>(status.st_size);
+
+    void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (address == MAP_FAILED) {
+        errorString = getSystemErrorString("mmap");
+        return;
+    }
+
+    auto newMapping = std::make_shared<Mapping>(address, size);
+    const RingHeader* header = newMapping->getRingHeader();
+
+    if (header->magic.load() != magic || header->version != version) {
+        errorString = "Not a frame ring, or not initialized yet";
+        return;
+    }
+    if (header->slotCount == 0 || getSegmentSize(header->slotCount, header->slotDataCapacity) > size) {
+        errorString = "The frame ring is truncated";
+        return;
+    }
+
+    mapping = newMapping;
+}
+
+bool SharedMemoryFrameConsumer::isValid() const
+{
+    return static_cast<bool>(mapping);
+}
+
+QString SharedMemoryFrameConsumer::getErrorString() const
+{
+    return errorString;
+}
+
+QImage SharedMemoryFrameConsumer::acquireNewFrame()
+{
+    if (!mapping) {
+        return QImage();
+    }
+
+    RingHeader* header = mapping->getRingHeader();
+
+    // If the producer keeps overtaking, give up for now; there will be another chance soon enough
+    for (int attempt = 0; attempt < 8; ++attempt) {
+        const quint64 sequence = header->latestSequence.load();
+        if (sequence == 0 || sequence == acquiredSequence) {
+            return QImage();
+        }
+
+        const quint32 slot = header->latestSlot.load();
+        if (slot >= header->slotCount) {
+            return QImage();
+        }
+
+        SlotHeader* slotHeader = mapping->getSlotHeader(slot);
+
+        slotHeader->readerCount.fetch_add(1);
+
+        if (slotHeader->state.load() == ReadySlot && slotHeader->sequence.load() == sequence) {
+            const bool isValidFrame = slotHeader->width > 0 && slotHeader->height > 0
+                    && slotHeader->bytesPerLine > 0
+                    && static_cast<size_t>(slotHeader->bytesPerLine) * slotHeader->height <= header->slotDataCapacity
+                    && slotHeader->format > QImage::Format_Invalid && slotHeader->format < QImage::NImageFormats;
+
+            QImage frame;
+
+            if (isValidFrame) {
+                SlotReservation* reservation = new SlotReservation{ mapping, slotHeader };
+                // const data: the image is read-only, so nothing is ever written back to the slot
+                const uchar* data = mapping->getSlotData(slot);
+                frame = QImage(data, slotHeader->width, slotHeader->height, slotHeader->bytesPerLine,
+                               static_cast<QImage::Format>(slotHeader->format), releaseSlot, reservation);
+                if (frame.isNull()) {
+                    // The cleanup function is not going to be called
+                    delete reservation;
+                }
+            }
+
+            if (frame.isNull()) {
+                slotHeader->readerCount.fetch_sub(1);
+            }
+            else {
+                acquiredSequence = sequence;
+            }
+
+            return frame;
+        }
+
+        // The producer got to the slot first
+        slotHeader->readerCount.fetch_sub(1);
+    }
+
+    return QImage();
+}
+
+quint64 SharedMemoryFrameConsumer::getAcquiredSequence() const
+{
+    return acquiredSequence;
+}
@@ -0,0 +1,106 @@
+#ifndef SHAREDMEMORYFRAMES_H
+#define SHAREDMEMORYFRAMES_H
+
+// Passing frames from a producer process (e.g., image acquisition) to QResultImageView without copying them.
+// The producer writes frames into a ring of slots in POSIX shared memory; the consumer wraps the slots as
+// read-only QImages, which can be passed to QResultImageView::setImage as such. A slot is reserved for as
+// long as any copy of the QImage wrapping it exists, so the ring needs more slots than the consumer holds
+// on to at a time (keep frame history limits in mind).
+
+#include <QImage>
+#include <QString>
+#include <atomic>
+#include <memory>
+
+namespace SharedMemoryFrames {
+
+    const quint32 magic = 0x51524956; // "QRIV"
+    const quint32 version = 1;
+
+    enum SlotState : quint32 {
+        EmptySlot,
+        WritingSlot,
+        ReadySlot
+    };
+
+    // The layout in shared memory is: RingHeader, slotCount SlotHeaders, and then the frame data of each slot
+    // (slotDataCapacity bytes, at offsets aligned to dataAlignment).
+    struct RingHeader {
+        std::atomic<quint32> magic;
+        quint32 version;
+        quint32 slotCount;
+        quint32 slotDataCapacity;
+        std::atomic<quint64> latestSequence; // 0 if nothing has been published yet
+        std::atomic<quint32> latestSlot;
+    };
+
+    struct SlotHeader {
+        std::atomic<quint32> state;
+        std::atomic<quint32> readerCount;
+        std::atomic<quint64> sequence;
+        qint32 width;
+        qint32 height;
+        qint32 bytesPerLine;
+        qint32 format; // QImage::Format
+    };
+
+    // The atomics are shared between processes, which works only if they are lock-free (and thereby address-free)
+    static_assert(ATOMIC_INT_LOCK_FREE == 2, "std::atomic<quint32> must always be lock-free");
+    static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "std::atomic<quint64> must always be lock-free");
+    static_assert(sizeof(std::atomic<quint32>) == sizeof(quint32) && sizeof(std::atomic<quint64>) == sizeof(quint64),
+                  "The atomics must have the same layout in every process");
+
+    const size_t dataAlignment = 64;
+
+    size_t getDataOffset(quint32 slotCount);
+    size_t getSegmentSize(quint32 slotCount, quint32 slotDataCapacity);
+
+    class Mapping;
+}
+
+class SharedMemoryFrameProducer
+{
+public:
+    // Creates (or re-creates) the named shared memory segment.
+    SharedMemoryFrameProducer(const QString& name, quint32 slotCount, quint32 maxFrameByteCount);
+    ~SharedMemoryFrameProducer();
+
+    bool isValid() const;
+    QString getErrorString() const;
+
+    // Copies the frame into a free slot. Returns false if the frame is too large, or if every slot
+    // is still being displayed.
+    bool publishFrame(const QImage& frame);
+
+private:
+    SharedMemoryFrameProducer(const SharedMemoryFrameProducer&) = delete;
+    SharedMemoryFrameProducer& operator=(const SharedMemoryFrameProducer&) = delete;
+
+    std::shared_ptr<SharedMemoryFrames::Mapping> mapping;
+    QString name;
+    QString errorString;
+    quint64 nextSequence = 1;
+};
+
+class SharedMemoryFrameConsumer
+{
+public:
+    // Opens a segment created by SharedMemoryFrameProducer.
+    explicit SharedMemoryFrameConsumer(const QString& name);
+
+    bool isValid() const;
+    QString getErrorString() const;
+
+    // Wraps the most recently published frame without copying it. Returns a null image if there is
+    // nothing newer than the frame previously acquired.
+    QImage acquireNewFrame();
+
+    quint64 getAcquiredSequence() const;
+
+private:
+    std::shared_ptr<SharedMemoryFrames::Mapping> mapping;
+    QString errorString;
+    quint64 acquiredSequence = 0;
+};
+
+#endif // SHAREDMEMORYFRAMES_H
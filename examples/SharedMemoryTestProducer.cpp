@@ -0,0 +1,56 @@
+// A stand-in for an acquisition process, for trying out the shared memory frame ingest locally.
+// Publishes a moving test pattern at about 25 frames per second:
+//
+//     SharedMemoryTestProducer [name] [width] [height]
+//
+// On the viewer side, poll for new frames, for example:
+//
+//     SharedMemoryFrameConsumer consumer("QResultImageViewTestFrames");
+//     ...
+//     const QImage frame = consumer.acquireNewFrame();
+//     if (!frame.isNull()) {
+//         view->setImage(frame);
+//     }
+
+#include "../SharedMemoryFrames.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+int main(int argc, char* argv[])
+{
+    const QString name = argc > 1 ? QString::fromLocal8Bit(argv[1]) : QString("QResultImageViewTestFrames");
+    const int width = argc > 2 ? atoi(argv[2]) : 2048;
+    const int height = argc > 3 ? atoi(argv[3]) : 1536;
+
+    if (width <= 0 || height <= 0) {
+        fprintf(stderr, "Usage: %s [name] [width] [height]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    QImage frame(width, height, QImage::Format_RGB32);
+
+    const quint32 slotCount = 8;
+    SharedMemoryFrameProducer producer(name, slotCount, static_cast<quint32>(frame.bytesPerLine() * height));
+
+    if (!producer.isValid()) {
+        fprintf(stderr, "%s\n", qPrintable(producer.getErrorString()));
+        return EXIT_FAILURE;
+    }
+
+    for (int frameIndex = 0; ; ++frameIndex) {
+        for (int y = 0; y < height; ++y) {
+            QRgb* line = reinterpret_cast<QRgb*>(frame.scanLine(y));
+            for (int x = 0; x < width; ++x) {
+                line[x] = qRgb((x + 4 * frameIndex) & 0xff, (y + 2 * frameIndex) & 0xff, (x ^ y) & 0xff);
+            }
+        }
+
+        if (!producer.publishFrame(frame)) {
+            fprintf(stderr, "Frame %d: %s\n", frameIndex, qPrintable(producer.getErrorString()));
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(40));
+    }
+}